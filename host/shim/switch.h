@@ -0,0 +1,295 @@
+#pragma once
+/*
+ * Just enough of libnx to build the installer, dumper and FTP code for Linux. Services the
+ * PC does not have are stubbed to their happy path: no other CFW is running, Smash is the
+ * running title, vibration and CPU boost do nothing. Threads and mutexes are pthreads.
+ *
+ * sdmc:/ and romfs:/ paths are left as they are. shimMount() changes into a scratch folder
+ * holding symlinks named "sdmc:" and "romfs:", so "sdmc:/x" is a relative path into the
+ * folder standing in for the SD card.
+ *
+ * Input comes from shimPressKeys(), one entry per hidScanInput().
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <atomic>
+#include <deque>
+#include <filesystem>
+#include <string>
+#include "sys/iosupport.h"
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int8_t s8;
+typedef int16_t s16;
+typedef int32_t s32;
+typedef int64_t s64;
+typedef u32 Handle;
+typedef u32 Result;
+
+#define BIT(n) (1U<<(n))
+#define R_SUCCEEDED(res) ((res)==0)
+#define R_FAILED(res) ((res)!=0)
+#define SHIM_NOT_SUPPORTED 0x1A80  // any nonzero Result is a failure
+
+#define CONSOLE_ESC(x) "\x1b[" #x
+#define CONSOLE_RESET   CONSOLE_ESC(0m)
+#define CONSOLE_BLACK   CONSOLE_ESC(30m)
+#define CONSOLE_RED     CONSOLE_ESC(31;1m)
+#define CONSOLE_GREEN   CONSOLE_ESC(32;1m)
+#define CONSOLE_YELLOW  CONSOLE_ESC(33;1m)
+#define CONSOLE_BLUE    CONSOLE_ESC(34;1m)
+#define CONSOLE_MAGENTA CONSOLE_ESC(35;1m)
+#define CONSOLE_CYAN    CONSOLE_ESC(36;1m)
+#define CONSOLE_WHITE   CONSOLE_ESC(37;1m)
+
+// console
+
+typedef struct PrintConsole { int unused; } PrintConsole;
+
+ssize_t shimConsoleWrite(void*, const char* buf, size_t size) {
+  return devoptab_list[STD_OUT]->write_r(nullptr, nullptr, buf, size);
+}
+
+// Sends stdout through devoptab_list[STD_OUT], unbuffered like the Switch console
+PrintConsole* consoleInit(PrintConsole* console) {
+  static FILE* console_out = nullptr;
+  if(console_out == nullptr) {
+    cookie_io_functions_t io = {nullptr, shimConsoleWrite, nullptr, nullptr};
+    console_out = fopencookie(nullptr, "w", io);
+    if(console_out != nullptr) {
+      fflush(stdout);
+      setvbuf(console_out, nullptr, _IONBF, 0);
+      stdout = console_out;
+    }
+  }
+  return console;
+}
+void consoleUpdate(PrintConsole*) { fflush(stdout); }
+void consoleClear(void) {}
+void consoleExit(PrintConsole*) { fflush(stdout); }
+
+// hid
+
+enum {
+  KEY_A = BIT(0), KEY_B = BIT(1), KEY_X = BIT(2), KEY_Y = BIT(3),
+  KEY_LSTICK = BIT(4), KEY_RSTICK = BIT(5), KEY_L = BIT(6), KEY_R = BIT(7),
+  KEY_ZL = BIT(8), KEY_ZR = BIT(9), KEY_PLUS = BIT(10), KEY_MINUS = BIT(11),
+  KEY_DLEFT = BIT(12), KEY_DUP = BIT(13), KEY_DRIGHT = BIT(14), KEY_DDOWN = BIT(15),
+  KEY_LSTICK_LEFT = BIT(16), KEY_LSTICK_UP = BIT(17), KEY_LSTICK_RIGHT = BIT(18), KEY_LSTICK_DOWN = BIT(19),
+  KEY_RSTICK_LEFT = BIT(20), KEY_RSTICK_UP = BIT(21), KEY_RSTICK_RIGHT = BIT(22), KEY_RSTICK_DOWN = BIT(23),
+};
+
+typedef enum { CONTROLLER_HANDHELD = 8, CONTROLLER_P1_AUTO = 10 } HidControllerID;
+typedef enum { TYPE_HANDHELD = BIT(0), TYPE_JOYCON_PAIR = BIT(1) } HidControllerType;
+
+typedef struct {
+  float amp_low;
+  float freq_low;
+  float amp_high;
+  float freq_high;
+} HidVibrationValue;
+
+std::deque<u64> shimKeys;
+u64 shimKeysNow = 0;
+
+// Queues the keys the next hidScanInput() reports as pressed
+void shimPressKeys(u64 keys) { shimKeys.push_back(keys); }
+
+void hidScanInput(void) {
+  shimKeysNow = 0;
+  if(!shimKeys.empty()) {
+    shimKeysNow = shimKeys.front();
+    shimKeys.pop_front();
+  }
+}
+u64 hidKeysDown(HidControllerID) { return shimKeysNow; }
+u64 hidKeysHeld(HidControllerID) { return shimKeysNow; }
+Result hidInitializeVibrationDevices(u32* handles, size_t count, HidControllerID, HidControllerType) {
+  memset(handles, 0, count * sizeof(u32));
+  return 0;
+}
+Result hidSendVibrationValues(const u32*, HidVibrationValue*, size_t) { return 0; }
+
+// applet
+
+typedef enum { AppletType_Application = 0, AppletType_SystemApplication = 1 } AppletType;
+typedef enum { ApmCpuBoostMode_Disabled = 0, ApmCpuBoostMode_Type1 = 1 } ApmCpuBoostMode;
+
+std::atomic<bool> shimExitRequested(false);
+
+bool appletMainLoop(void) { return !shimExitRequested; }
+AppletType appletGetAppletType(void) { return AppletType_Application; }
+Result appletSetCpuBoostMode(ApmCpuBoostMode) { return 0; }
+Result appletSetMediaPlaybackState(bool) { return 0; }
+Result appletBeginBlockingHomeButton(s64) { return 0; }
+Result appletEndBlockingHomeButton(void) { return 0; }
+Result appletRequestLaunchApplication(u64, void*) { return SHIM_NOT_SUPPORTED; }
+
+// sm, pm and nifm
+
+#define SHIM_SMASH_TID 0x01006A800016E000
+
+Result smRegisterService(Handle* handle, const char*, bool, int) { *handle = 0; return 0; }
+Result smUnregisterService(const char*) { return 0; }
+Result pmdmntInitialize(void) { return 0; }
+void pmdmntExit(void) {}
+Result pmdmntGetApplicationPid(u64* pid) { *pid = 1; return 0; }
+Result pminfoInitialize(void) { return 0; }
+void pminfoExit(void) {}
+Result pminfoGetTitleId(u64* tid, u64) { *tid = SHIM_SMASH_TID; return 0; }
+Result nifmInitialize(void) { return 0; }
+void nifmExit(void) {}
+
+// svc
+
+Result svcCloseHandle(Handle) { return 0; }
+void svcSleepThread(s64 nano) {
+  if(nano <= 0) {
+    sched_yield();
+    return;
+  }
+  struct timespec ts = {(time_t)(nano / 1000000000), (long)(nano % 1000000000)};
+  while(nanosleep(&ts, &ts) != 0 && errno == EINTR) {}
+}
+
+// threads, priority and core are ignored
+
+typedef void (*ThreadFunc)(void*);
+
+typedef struct {
+  Handle handle;
+  pthread_t pthread;
+  ThreadFunc entry;
+  void* arg;
+} Thread;
+
+typedef pthread_mutex_t Mutex;
+
+std::atomic<Handle> shimNextHandle(1);
+thread_local Handle shimCurHandle = 0;
+
+void* shimThreadStart(void* arg) {
+  Thread* t = (Thread*)arg;
+  shimCurHandle = t->handle;
+  t->entry(t->arg);
+  return nullptr;
+}
+
+Result threadCreate(Thread* t, ThreadFunc entry, void* arg, size_t, int, int) {
+  t->handle = shimNextHandle++;
+  t->entry = entry;
+  t->arg = arg;
+  return 0;
+}
+Result threadStart(Thread* t) { return pthread_create(&t->pthread, nullptr, shimThreadStart, t) == 0 ? 0 : SHIM_NOT_SUPPORTED; }
+Result threadWaitForExit(Thread* t) { return pthread_join(t->pthread, nullptr) == 0 ? 0 : SHIM_NOT_SUPPORTED; }
+Result threadClose(Thread*) { return 0; }
+Handle threadGetCurHandle(void) { return shimCurHandle; }
+
+void mutexInit(Mutex* m) { pthread_mutex_init(m, nullptr); }
+void mutexLock(Mutex* m) { pthread_mutex_lock(m); }
+void mutexUnlock(Mutex* m) { pthread_mutex_unlock(m); }
+
+// romfs and fsdev, romfs:/ is mapped by shimMount() instead
+
+#define FS_CREATE_BIG_FILE BIT(0)
+
+Result romfsMountFromCurrentProcess(const char*) { return 0; }
+Result romfsUnmount(const char*) { return 0; }
+
+Result fsdevCreateFile(const char* path, size_t size, int) {
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if(fd < 0) return SHIM_NOT_SUPPORTED;
+  bool ok = ftruncate(fd, size) == 0;
+  close(fd);
+  return ok ? 0 : SHIM_NOT_SUPPORTED;
+}
+
+Result fsdevDeleteDirectoryRecursively(const char* path) {
+  std::error_code ec;
+  std::filesystem::remove_all(path, ec);
+  return ec ? SHIM_NOT_SUPPORTED : 0;
+}
+
+// swkbd, there is no keyboard so every prompt is cancelled
+
+typedef struct { int unused; } SwkbdConfig;
+
+Result swkbdCreate(SwkbdConfig*, s32) { return 0; }
+void swkbdConfigMakePresetDefault(SwkbdConfig*) {}
+void swkbdConfigSetGuideText(SwkbdConfig*, const char*) {}
+void swkbdConfigSetInitialText(SwkbdConfig*, const char*) {}
+void swkbdConfigSetStringLenMax(SwkbdConfig*, u32) {}
+Result swkbdShow(SwkbdConfig*, char* out, size_t size) {
+  if(size > 0) out[0] = 0;
+  return SHIM_NOT_SUPPORTED;
+}
+void swkbdClose(SwkbdConfig*) {}
+
+typedef struct { int unused; } SwkbdInline;
+typedef struct { int unused; } SwkbdAppearArg;
+typedef struct { int unused; } SwkbdChangedStringArg;
+typedef struct { int unused; } SwkbdDecidedEnterArg;
+typedef enum { SwkbdType_Normal = 0 } SwkbdType;
+typedef enum { SwkbdInlineMode_AppletDisplay = 0 } SwkbdInlineMode;
+typedef enum { SwkbdState_Inactive = 0 } SwkbdState;
+typedef void (*VoidFn)(void);
+typedef void (*SwkbdChangedStringCb)(const char* str, SwkbdChangedStringArg* arg);
+typedef void (*SwkbdDecidedEnterCb)(const char* str, SwkbdDecidedEnterArg* arg);
+
+Result swkbdInlineCreate(SwkbdInline*) { return SHIM_NOT_SUPPORTED; }
+Result swkbdInlineClose(SwkbdInline*) { return 0; }
+Result swkbdInlineLaunchForLibraryApplet(SwkbdInline*, u8, u8) { return SHIM_NOT_SUPPORTED; }
+Result swkbdInlineUpdate(SwkbdInline*, SwkbdState*) { return SHIM_NOT_SUPPORTED; }
+void swkbdInlineSetUtf8Mode(SwkbdInline*, bool) {}
+void swkbdInlineSetChangedStringCallback(SwkbdInline*, SwkbdChangedStringCb) {}
+void swkbdInlineSetDecidedEnterCallback(SwkbdInline*, SwkbdDecidedEnterCb) {}
+void swkbdInlineSetDecidedCancelCallback(SwkbdInline*, VoidFn) {}
+void swkbdInlineMakeAppearArg(SwkbdAppearArg*, SwkbdType) {}
+void swkbdInlineAppearArgSetOkButtonText(SwkbdAppearArg*, const char*) {}
+void swkbdInlineAppear(SwkbdInline*, const SwkbdAppearArg*) {}
+void swkbdInlineSetInputText(SwkbdInline*, const char*) {}
+void swkbdInlineSetCursorPos(SwkbdInline*, s32) {}
+
+// path mapping
+
+std::string shimScratchDir;
+
+// sdDir stands in for the SD card, romfsDir for Smash's romfs (may be empty).
+// Relative paths given to the tool have to be made absolute before this is called.
+bool shimMount(const std::string& sdDir, const std::string& romfsDir) {
+  char scratch[] = "/tmp/ummhost.XXXXXX";
+  if(mkdtemp(scratch) == nullptr) return false;
+  shimScratchDir = scratch;
+  std::error_code ec;
+  std::filesystem::create_directory_symlink(std::filesystem::absolute(sdDir), shimScratchDir + "/sdmc:", ec);
+  if(!ec && !romfsDir.empty())
+    std::filesystem::create_directory_symlink(std::filesystem::absolute(romfsDir), shimScratchDir + "/romfs:", ec);
+  if(ec || chdir(shimScratchDir.c_str()) != 0) {
+    std::filesystem::remove_all(shimScratchDir, ec);
+    return false;
+  }
+  return true;
+}
+
+// Removes the scratch folder, the symlinks go but not what they point to
+void shimUnmount() {
+  if(shimScratchDir.empty()) return;
+  std::error_code ec;
+  std::filesystem::remove(shimScratchDir + "/sdmc:", ec);
+  std::filesystem::remove(shimScratchDir + "/romfs:", ec);
+  std::filesystem::remove(shimScratchDir, ec);
+  shimScratchDir.clear();
+}
@@ -0,0 +1,32 @@
+#pragma once
+/*
+ * The part of newlib's device table the installer hooks. consoleInit() in switch.h points
+ * stdout at devoptab_list[STD_OUT], as libnx's console does, so replacing that entry
+ * redirects printf() the same way it does on the Switch.
+ */
+#include <stdio.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+struct _reent;
+
+enum { STD_IN, STD_OUT, STD_ERR, STD_MAX = 16 };
+
+typedef struct {
+  const char* name;
+  size_t structSize;
+  ssize_t (*write_r)(struct _reent* r, void* fd, const char* ptr, size_t len);
+} devoptab_t;
+
+inline ssize_t shimWriteStdout(struct _reent*, void*, const char* ptr, size_t len) {
+  size_t done = 0;
+  while(done < len) {
+    ssize_t n = write(STDOUT_FILENO, ptr + done, len - done);
+    if(n <= 0) return done ? (ssize_t)done : n;
+    done += n;
+  }
+  return done;
+}
+
+inline const devoptab_t shimStdoutDevoptab = {"con", 0, shimWriteStdout};
+inline const devoptab_t* devoptab_list[STD_MAX] = {nullptr, &shimStdoutDevoptab, nullptr};
@@ -0,0 +1,272 @@
+/*
+ * Generates a synthetic SD card to benchmark installs on, the same for a given seed.
+ *
+ *   ummgen [-s arc MiB] [-l level] [-seed n] <sd dir>
+ *
+ * Writes <sd dir>/atmosphere/titles/01006A800016E000/romfs/data.arc, filled with textures,
+ * audio and params stored as real zstd frames (or raw when compressing saves too little),
+ * and the matching UltimateModManager/Offsets.txt. Three mods are generated against it:
+ *   bench-textures   many small textures
+ *   bench-audio      a few huge audio files, mostly in raw regions
+ *   bench-mixed      some of everything
+ * Each mod file gets its own compressibility around the vanilla one, so some fit at
+ * level 3 and some need the higher levels. Run them with "ummhost -s <sd dir> bench".
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <filesystem>
+#include <string>
+#include <vector>
+typedef uint64_t u64;
+#include "zstdFrame.h"
+
+namespace fs = std::filesystem;
+
+#define GEN_ALIGN 0x10
+#define GEN_RAW_SAVING 0.05  // regions are stored raw unless compressing saves more than this
+#define GEN_CHUNK 64         // data is made of GEN_CHUNK byte runs, random or repeated
+
+// A kind of file in data.arc
+struct genKind {
+  const char* name;
+  u64 minSize;
+  u64 maxSize;
+  double randomness;  // share of random runs in vanilla files, the rest repeat earlier ones
+  double share;       // of data.arc
+};
+
+genKind kinds[] = {
+  {"texture", 0x4000, 0x40000, 0.45, 0.45},
+  {"audio", 0x100000, 0x800000, 0.99, 0.40},
+  {"param", 0x400, 0x10000, 0.15, 0.15},
+};
+#define KIND_TEXTURE 0
+#define KIND_AUDIO 1
+#define KIND_PARAM 2
+#define KIND_COUNT 3
+
+const char* fighters[] = {"mario", "link", "samus", "pikachu", "kirby", "fox", "ness", "yoshi",
+                          "peach", "zelda", "marth", "ike", "cloud", "inkling", "ridley", "joker"};
+#define FIGHTER_COUNT 16
+
+struct genEntry {
+  std::string path;
+  int kind;
+  u64 offset;
+  u64 compSize;
+  u64 decompSize;
+};
+
+// splitmix64
+u64 nextRandom(u64& state) {
+  u64 z = (state += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+double nextUnit(u64& state) {
+  return (nextRandom(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+u64 nextSize(u64& state, u64 minSize, u64 maxSize) {
+  return minSize + nextRandom(state) % (maxSize - minSize + 1);
+}
+
+// Fills buf with runs that are random with the given probability and otherwise repeat
+// one of the last 4 KiB, so zstd gets about that share of the input as literals
+void fillData(char* buf, u64 size, double randomness, u64& state) {
+  for(u64 pos = 0; pos < size; pos += GEN_CHUNK) {
+    u64 len = std::min((u64)GEN_CHUNK, size - pos);
+    if(pos < GEN_CHUNK || nextUnit(state) < randomness) {
+      for(u64 i = 0; i < len; i += 8) {
+        u64 word = nextRandom(state);
+        memcpy(buf + pos + i, &word, std::min((u64)8, len - i));
+      }
+    }
+    else {
+      u64 back = GEN_CHUNK + nextRandom(state) % std::min(pos - GEN_CHUNK + 1, (u64)0x1000);
+      memcpy(buf + pos, buf + pos - back, len);
+    }
+  }
+}
+
+std::string entryPath(int kind, size_t index) {
+  const char* fighter = fighters[index % FIGHTER_COUNT];
+  char path[0x100];
+  if(kind == KIND_TEXTURE)
+    snprintf(path, sizeof(path), "fighter/%s/model/body/c%02zu/def_%s_%03zu_col.nutexb", fighter,
+             index / FIGHTER_COUNT % 8, fighter, index);
+  else if(kind == KIND_AUDIO)
+    snprintf(path, sizeof(path), "sound/bank/fighter_voice/vc_%s_%02zu.nus3audio", fighter, index / FIGHTER_COUNT);
+  else
+    snprintf(path, sizeof(path), "fighter/%s/param/%s_%03zu.prc", fighter, fighter, index);
+  return path;
+}
+
+bool writeAll(FILE* f, const char* data, u64 size) {
+  return fwrite(data, 1, size, f) == size;
+}
+
+// Lays out data.arc until it reaches arcSize, picking the kind furthest below its share
+bool writeArc(const std::string& path, u64 arcSize, int level, u64& state, std::vector<genEntry>& entries) {
+  FILE* f = fopen(path.c_str(), "wb");
+  if(f == nullptr) return false;
+  ZSTD_CCtx* cctx = ZSTD_createCCtx();
+  std::vector<char> data, frame;
+  u64 kindBytes[KIND_COUNT] = {};
+  size_t kindCount[KIND_COUNT] = {};
+  u64 offset = 0x100;
+  bool ok = true;
+  data.resize(offset);
+  fillData(data.data(), offset, 1, state);
+  ok &= writeAll(f, data.data(), offset);
+  while(ok && offset < arcSize) {
+    int kind = 0;
+    for(int i = 1; i < KIND_COUNT; i++) {
+      if(kindBytes[i] / kinds[i].share < kindBytes[kind] / kinds[kind].share) kind = i;
+    }
+    genEntry entry = {entryPath(kind, kindCount[kind]), kind, offset, 0, 0};
+    entry.decompSize = nextSize(state, kinds[kind].minSize, kinds[kind].maxSize);
+    data.resize(entry.decompSize);
+    fillData(data.data(), entry.decompSize, kinds[kind].randomness, state);
+    frame.resize(ZSTD_compressBound(entry.decompSize));
+    size_t frameSize = ZSTD_compressCCtx(cctx, frame.data(), frame.size(), data.data(), entry.decompSize, level);
+    if(!ZSTD_isError(frameSize) && frameSize < entry.decompSize * (1 - GEN_RAW_SAVING)) {
+      entry.compSize = frameSize;
+      ok &= writeAll(f, frame.data(), frameSize);
+    }
+    else {
+      entry.compSize = entry.decompSize;
+      ok &= writeAll(f, data.data(), entry.decompSize);
+    }
+    u64 padding = (GEN_ALIGN - entry.compSize % GEN_ALIGN) % GEN_ALIGN;
+    static const char zeros[GEN_ALIGN] = {};
+    ok &= writeAll(f, zeros, padding);
+    offset += entry.compSize + padding;
+    kindBytes[kind] += entry.compSize;
+    kindCount[kind]++;
+    entries.push_back(entry);
+  }
+  ZSTD_freeCCtx(cctx);
+  ok &= fclose(f) == 0;
+  return ok;
+}
+
+bool writeOffsets(const std::string& path, u64 seed, const std::vector<genEntry>& entries) {
+  FILE* f = fopen(path.c_str(), "w");
+  if(f == nullptr) return false;
+  fprintf(f, "ummgen synthetic seed %llu\n", (unsigned long long)seed);
+  for(const genEntry& entry : entries)
+    fprintf(f, "%s,%llx,%llx,%llx\n", entry.path.c_str(), (unsigned long long)entry.offset,
+            (unsigned long long)entry.compSize, (unsigned long long)entry.decompSize);
+  return fclose(f) == 0;
+}
+
+// Writes a replacement for entry into modDir. Files for compressed regions start a little
+// more or less compressible than vanilla and are made more compressible until the
+// installer's compressFrame() fits them.
+bool writeModFile(const fs::path& modDir, const genEntry& entry, ZSTD_CCtx* cctx, u64& state, u64& bytes) {
+  std::vector<char> data;
+  double randomness = kinds[entry.kind].randomness + nextUnit(state) * 0.35 - 0.3;
+  if(entry.compSize == entry.decompSize) {
+    data.resize(entry.decompSize - nextRandom(state) % (entry.decompSize / 8));
+    fillData(data.data(), data.size(), std::clamp(randomness, 0.0, 1.0), state);
+  }
+  else {
+    data.resize(entry.decompSize);
+    std::vector<char> frame(entry.compSize + 1);
+    u64 frameSize;
+    do {
+      randomness = std::max(randomness, 0.0);
+      fillData(data.data(), data.size(), randomness, state);
+      randomness -= 0.1;
+    } while(!compressFrame(cctx, data.data(), data.size(), frame.data(), entry.compSize, frameSize) && randomness > -0.1);
+  }
+  fs::path path = modDir / entry.path;
+  fs::create_directories(path.parent_path());
+  FILE* f = fopen(path.c_str(), "wb");
+  if(f == nullptr) return false;
+  bool ok = writeAll(f, data.data(), data.size());
+  ok &= fclose(f) == 0;
+  bytes += data.size();
+  return ok;
+}
+
+// Up to count entries of a kind, spread over data.arc or the largest ones
+std::vector<const genEntry*> pickEntries(const std::vector<genEntry>& entries, int kind, size_t count, bool largest) {
+  std::vector<const genEntry*> all;
+  for(const genEntry& entry : entries) {
+    if(entry.kind == kind) all.push_back(&entry);
+  }
+  if(largest)
+    std::stable_sort(all.begin(), all.end(), [](const genEntry* a, const genEntry* b) { return a->decompSize > b->decompSize; });
+  if(all.size() <= count) return all;
+  std::vector<const genEntry*> picked;
+  for(size_t i = 0; i < count; i++)
+    picked.push_back(all[largest ? i : i * all.size() / count]);
+  return picked;
+}
+
+bool writeMod(const fs::path& modsDir, const char* name, const std::vector<const genEntry*>& picked, u64& state) {
+  fs::path modDir = modsDir / name;
+  fs::remove_all(modDir);
+  ZSTD_CCtx* cctx = ZSTD_createCCtx();
+  u64 bytes = 0;
+  bool ok = true;
+  for(const genEntry* entry : picked)
+    ok &= writeModFile(modDir, *entry, cctx, state, bytes);
+  ZSTD_freeCCtx(cctx);
+  printf("%s: %zu file(s), %.1f MiB\n", name, picked.size(), bytes / 1048576.0);
+  return ok;
+}
+
+int main(int argc, char** argv) {
+  u64 arcMiB = 128;
+  int level = 3;
+  u64 seed = 1;
+  int arg = 1;
+  for(; arg < argc && argv[arg][0] == '-'; arg++) {
+    if(strcmp(argv[arg], "-s") == 0 && arg + 1 < argc) arcMiB = strtoull(argv[++arg], nullptr, 10);
+    else if(strcmp(argv[arg], "-l") == 0 && arg + 1 < argc) level = atoi(argv[++arg]);
+    else if(strcmp(argv[arg], "-seed") == 0 && arg + 1 < argc) seed = strtoull(argv[++arg], nullptr, 10);
+    else break;
+  }
+  if(argc - arg != 1 || arcMiB == 0) {
+    fprintf(stderr, "usage: %s [-s arc MiB] [-l level] [-seed n] <sd dir>\n", argv[0]);
+    return 1;
+  }
+  fs::path sdDir = argv[arg];
+  fs::path arcDir = sdDir / "atmosphere/titles/01006A800016E000/romfs";
+  fs::path managerDir = sdDir / "UltimateModManager";
+  fs::create_directories(arcDir);
+  fs::create_directories(managerDir / "mods");
+
+  u64 state = seed;
+  std::vector<genEntry> entries;
+  if(!writeArc((arcDir / "data.arc").string(), arcMiB * 0x100000, level, state, entries) ||
+     !writeOffsets((managerDir / "Offsets.txt").string(), seed, entries)) {
+    fprintf(stderr, "Failed to write data.arc or Offsets.txt in %s\n", sdDir.c_str());
+    return 1;
+  }
+  size_t raw = 0;
+  for(const genEntry& entry : entries)
+    raw += entry.compSize == entry.decompSize;
+  printf("data.arc: %.1f MiB, %zu file(s), %zu raw\n", fs::file_size(arcDir / "data.arc") / 1048576.0, entries.size(), raw);
+
+  fs::path modsDir = managerDir / "mods";
+  std::vector<const genEntry*> mixed = pickEntries(entries, KIND_TEXTURE, 80, false);
+  for(const genEntry* entry : pickEntries(entries, KIND_AUDIO, 2, false)) mixed.push_back(entry);
+  for(const genEntry* entry : pickEntries(entries, KIND_PARAM, 150, false)) mixed.push_back(entry);
+  bool ok = writeMod(modsDir, "bench-textures", pickEntries(entries, KIND_TEXTURE, 400, false), state);
+  ok &= writeMod(modsDir, "bench-audio", pickEntries(entries, KIND_AUDIO, 4, true), state);
+  ok &= writeMod(modsDir, "bench-mixed", mixed, state);
+  if(!ok) {
+    fprintf(stderr, "Failed to write the mods in %s\n", modsDir.c_str());
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,290 @@
+/*
+ * The installer, dumper and FTP server built for Linux against the libnx shim in shim/, so
+ * the code the Switch runs can be profiled with perf and checked with sanitizers.
+ *
+ *   ummhost [-s sd dir] [-r romfs dir] [-w] [-n runs] [-v] <command> [mod ...]
+ *
+ *   install <mod ...>     install mods/<mod>, overlaps go to the mod ranked higher in
+ *                         priority.txt, then alphabetically
+ *   uninstall <mod ...>   restore the regions of the mods, "backups" restores all of them
+ *   dryrun <mod ...>      predict an install and write dryrun.json
+ *   profile <name>        switch to a saved profile
+ *   recover               finish or roll back an interrupted install
+ *   dump                  copy <romfs dir>/data.arc to the SD card
+ *   md5                   hash the data.arc on the SD card
+ *   ftp                   run the FTP server on the current directory
+ *   bench [mod ...]       install and uninstall each mod -n times (default 3), the
+ *                         bench-* mods from ummgen if none are given
+ *
+ * The sd dir (default ".") stands in for the root of the SD card, so it holds
+ * UltimateModManager/ and atmosphere/titles/01006A800016E000/romfs/data.arc. -w runs the job
+ * on the install worker thread like the menu does, instead of on the main thread.
+ *
+ * bench hides the installer's output unless -v is given, and prints the time, the bytes
+ * written to data.arc per second and the time of each phase for every run, then the median
+ * of each mod, averaging the two middle runs when the count is even. The runs are also
+ * written to reports/bench-<date>.json. data.arc is checked to be the same after every
+ * uninstall. The PC's page cache stays warm, so runs after the first measure the installer
+ * rather than the disk.
+ */
+#include <switch.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include "dumper.h"
+#include "mod_installer.h"
+extern "C" {
+#include "ftp_main.h"
+#include "console.h"
+}
+
+void usage() {
+  fprintf(stderr, "usage: ummhost [-s sd dir] [-r romfs dir] [-w] [-n runs] [-v] "
+                  "install|uninstall|dryrun <mod ...> | profile <name> | recover | dump | md5 | ftp | bench [mod ...]\n");
+}
+
+// Runs job like modInstallerMainLoop() does, on the worker if useWorker is set
+void runJob(void (*job)(), bool useWorker) {
+  loadConfig();
+  if(useWorker && startWorker(job)) {
+    while(!updateWorker(0))
+      svcSleepThread(10000000);
+  }
+  else job();
+  finishJob();
+}
+
+// One install or uninstall of a bench run
+struct benchRun {
+  std::string mod;
+  const char* kind;
+  double seconds;
+  u64 arcBytes;  // written to data.arc
+  u64 modBytes;
+  phaseTotal phases[PHASE_COUNT];
+};
+
+ssize_t discardOutput(struct _reent*, void*, const char*, size_t len) {
+  return len;
+}
+const devoptab_t quietDevoptab = {"null", 0, discardOutput};
+
+u64 folderBytes(const std::string& path) {
+  u64 bytes = 0;
+  std::error_code ec;
+  for(const auto& file : std::filesystem::recursive_directory_iterator(path, ec)) {
+    if(file.is_regular_file()) bytes += file.file_size();
+  }
+  return bytes;
+}
+
+benchRun benchJob(const std::string& mod, bool uninstall, bool useWorker, bool verbose) {
+  benchRun run = {mod, uninstall ? "uninstall" : "install", 0, 0, 0, {}};
+  installing = uninstall ? UNINSTALL : INSTALL;
+  dryRun = false;
+  deleteMod = false;
+  mod_dirs.push_back("mods/" + mod);
+  run.modBytes = folderBytes(std::string(mods_root) + mod);
+  const devoptab_t* shown = devoptab_list[STD_OUT];
+  if(!verbose) devoptab_list[STD_OUT] = &quietDevoptab;
+  auto start = std::chrono::steady_clock::now();
+  runJob(installJob, useWorker);
+  run.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  devoptab_list[STD_OUT] = shown;
+  std::copy(phaseTotals, phaseTotals + PHASE_COUNT, run.phases);
+  run.arcBytes = phaseTotals[PHASE_WRITE].bytes + phaseTotals[PHASE_RESTORE].bytes;
+  return run;
+}
+
+void printBenchRun(const benchRun& run, const char* label) {
+  printf("%-20s %-9s %-6s %7.2f s %8.1f MiB/s ", run.mod.c_str(), run.kind, label, run.seconds,
+         run.seconds > 0 ? run.arcBytes / run.seconds / 0x100000 : 0);
+  for(int i = 0; i < PHASE_COUNT; i++) {
+    if(run.phases[i].seconds >= 0.005)
+      printf(" %s %.2f", phaseNames[i], run.phases[i].seconds);
+  }
+  printf("\n");
+}
+
+// The middle run, or the average of the two middle runs for an even count
+benchRun medianRun(std::vector<benchRun> runs) {
+  std::sort(runs.begin(), runs.end(), [](const benchRun& a, const benchRun& b) { return a.seconds < b.seconds; });
+  benchRun median = runs[runs.size() / 2];
+  if(runs.size() % 2 != 0)
+    return median;
+  const benchRun& lower = runs[runs.size() / 2 - 1];
+  median.seconds = (lower.seconds + median.seconds) / 2;
+  median.arcBytes = (lower.arcBytes + median.arcBytes) / 2;
+  median.modBytes = (lower.modBytes + median.modBytes) / 2;
+  for(int i = 0; i < PHASE_COUNT; i++) {
+    median.phases[i].seconds = (lower.phases[i].seconds + median.phases[i].seconds) / 2;
+    median.phases[i].bytes = (lower.phases[i].bytes + median.phases[i].bytes) / 2;
+    median.phases[i].calls = (lower.phases[i].calls + median.phases[i].calls) / 2;
+  }
+  return median;
+}
+
+bool writeBenchJSON(const std::string& path, const std::vector<benchRun>& runs) {
+  FILE* f = fopen(path.c_str(), "w");
+  if(!f) return false;
+  fprintf(f, "{\n  \"runs\": [");
+  for(size_t i = 0; i < runs.size(); i++) {
+    const benchRun& run = runs[i];
+    fprintf(f, "%s\n    {\"mod\": \"%s\", \"kind\": \"%s\", \"seconds\": %.3f, \"arcBytes\": %lu, \"modBytes\": %lu, \"phases\": {",
+            i ? "," : "", jsonEscape(run.mod).c_str(), run.kind, run.seconds, run.arcBytes, run.modBytes);
+    for(int phase = 0; phase < PHASE_COUNT; phase++)
+      fprintf(f, "%s\"%s\": %.3f", phase ? ", " : "", phaseNames[phase], run.phases[phase].seconds);
+    fprintf(f, "}}");
+  }
+  fprintf(f, "\n  ]\n}\n");
+  fclose(f);
+  return true;
+}
+
+// Installs and uninstalls every mod runs times, returns false if data.arc was not restored
+bool bench(std::vector<std::string> mods, int runs, bool useWorker, bool verbose) {
+  if(mods.empty()) {
+    std::error_code ec;
+    for(const auto& dir : std::filesystem::directory_iterator(mods_root, ec)) {
+      std::string name = dir.path().filename().string();
+      if(dir.is_directory() && name.compare(0, 6, "bench-") == 0) mods.push_back(name);
+    }
+    std::sort(mods.begin(), mods.end());
+  }
+  if(mods.empty()) {
+    printf("No mods to benchmark, generate them with ummgen\n");
+    return false;
+  }
+  std::string arc = arcPath();
+  u64 vanillaHash = hashFile(arc.c_str());
+  bool restored = true;
+  std::vector<benchRun> all;
+  for(const std::string& mod : mods) {
+    std::vector<benchRun> installs, uninstalls;
+    for(int i = 0; i < runs; i++) {
+      char label[0x10];
+      snprintf(label, sizeof(label), "run %d", i + 1);
+      installs.push_back(benchJob(mod, false, useWorker, verbose));
+      printBenchRun(installs.back(), label);
+      uninstalls.push_back(benchJob(mod, true, useWorker, verbose));
+      printBenchRun(uninstalls.back(), label);
+      if(hashFile(arc.c_str()) != vanillaHash) {
+        printf(CONSOLE_RED "data.arc was not restored after uninstalling %s\n" CONSOLE_RESET, mod.c_str());
+        restored = false;
+        break;
+      }
+    }
+    for(std::vector<benchRun>* jobs : {&installs, &uninstalls}) {
+      if(!jobs->empty()) printBenchRun(medianRun(*jobs), "median");
+      all.insert(all.end(), jobs->begin(), jobs->end());
+    }
+    if(!restored) break;
+  }
+
+  mkdir(reportsRoot, 0777);
+  char name[0x40];
+  std::time_t now = std::time(0);
+  strftime(name, sizeof(name), "bench-%Y%m%d-%H%M%S.json", std::localtime(&now));
+  std::string path = std::string(reportsRoot) + name;
+  if(writeBenchJSON(path, all))
+    printf("Benchmark written to %s\n", path.c_str());
+  else
+    printf(CONSOLE_RED "Failed to write %s\n" CONSOLE_RESET, path.c_str());
+  return restored;
+}
+
+int main(int argc, char** argv) {
+  std::string sdDir = ".";
+  std::string romfsDir;
+  bool useWorker = false;
+  bool verbose = false;
+  int runs = 3;
+  int arg = 1;
+  for(; arg < argc && argv[arg][0] == '-'; arg++) {
+    if(strcmp(argv[arg], "-s") == 0 && arg + 1 < argc) sdDir = argv[++arg];
+    else if(strcmp(argv[arg], "-r") == 0 && arg + 1 < argc) romfsDir = argv[++arg];
+    else if(strcmp(argv[arg], "-w") == 0) useWorker = true;
+    else if(strcmp(argv[arg], "-n") == 0 && arg + 1 < argc) runs = std::max(atoi(argv[++arg]), 1);
+    else if(strcmp(argv[arg], "-v") == 0) verbose = true;
+    else {
+      usage();
+      return 1;
+    }
+  }
+  if(arg >= argc) {
+    usage();
+    return 1;
+  }
+  std::string command = argv[arg++];
+  std::vector<std::string> mods(argv + arg, argv + argc);
+
+  if(!std::filesystem::is_directory(sdDir) || (!romfsDir.empty() && !std::filesystem::is_directory(romfsDir))) {
+    fprintf(stderr, "%s is not a directory\n", std::filesystem::is_directory(sdDir) ? romfsDir.c_str() : sdDir.c_str());
+    return 1;
+  }
+  if(!shimMount(sdDir, romfsDir)) {
+    fprintf(stderr, "Failed to map sdmc:/ to %s\n", sdDir.c_str());
+    return 1;
+  }
+  consoleInit(NULL);
+
+  int ret = 0;
+  if(command == "install" || command == "uninstall" || command == "dryrun") {
+    if(mods.empty()) {
+      usage();
+      ret = 1;
+    }
+    else {
+      installing = command == "uninstall" ? UNINSTALL : INSTALL;
+      dryRun = command == "dryrun";
+      deleteMod = false;
+      recoverInterruptedInstall();
+      for(const std::string& mod : mods)
+        mod_dirs.push_back(mod == "backups" ? mod : "mods/" + mod);
+      runJob(installJob, useWorker);
+    }
+  }
+  else if(command == "profile" && mods.size() == 1) {
+    installing = INSTALL;
+    dryRun = false;
+    recoverInterruptedInstall();
+    workerProfile = mods[0];
+    runJob(switchProfileJob, useWorker);
+  }
+  else if(command == "recover") {
+    if(!recoverInterruptedInstall())
+      printf("Nothing to recover\n");
+  }
+  else if(command == "dump") {
+    if(romfsDir.empty()) {
+      fprintf(stderr, "dump needs -r\n");
+      ret = 1;
+    }
+    else dumperMainLoop(KEY_A);
+  }
+  else if(command == "md5")
+    dumperMainLoop(KEY_X);
+  else if(command == "ftp")
+    ftp_main();
+  else if(command == "bench") {
+    recoverInterruptedInstall();
+    ret = bench(mods, runs, useWorker, verbose) ? 0 : 2;
+  }
+  else {
+    usage();
+    ret = 1;
+  }
+  printf("\n");
+
+  stopIndexer();
+  closeVanillaArc();
+  consoleExit(NULL);
+  shimUnmount();
+  return ret;
+}
@@ -0,0 +1,233 @@
+/*
+ * Precompiles a mod folder on a PC, so the console only has to copy bytes.
+ *
+ *   ummpack [-j threads] [-o mod.umm | -d outdir] Offsets.txt <mod folder>
+ *   ummpack -p <vanilla file> <modded file> <out.ummpatch>
+ *
+ * Every file is compressed and padded to exactly its compSize with the same code the
+ * installer uses, then checked by decompressing it again. The result is written as a
+ * .umm package (default <mod folder>.umm) or, with -d, as loose 0x<offset> files that
+ * the installer writes to data.arc as is.
+ *
+ * -p makes a patch from two uncompressed copies of an arc file instead. Put it in a mod
+ * folder as <arc path>.ummpatch and the console applies it to its own data.arc. Patches
+ * are not packed, as they need the console's data.arc.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+typedef uint64_t u64;
+#include "offsetFile.h"
+#include "zstdFrame.h"
+#include "ummPackage.h"
+#include "modPatch.h"
+
+namespace fs = std::filesystem;
+
+struct packJob {
+  std::string filePath;
+  std::string arcPath;
+  ummEntry entry;
+  std::vector<char> payload;
+  std::string error;
+};
+
+std::vector<char> readFile(const std::string& path) {
+  std::vector<char> data;
+  FILE* f = fopen(path.c_str(), "rb");
+  if(f == nullptr) return data;
+  fseek(f, 0, SEEK_END);
+  data.resize(ftell(f));
+  fseek(f, 0, SEEK_SET);
+  data.resize(fread(data.data(), 1, data.size(), f));
+  fclose(f);
+  return data;
+}
+
+void packFile(packJob& job, offsetFile& offsets, ZSTD_CCtx* cctx, ZSTD_DCtx* dctx) {
+  std::vector<char> data = readFile(job.filePath);
+  std::string fileName = fs::path(job.filePath).filename().string();
+  if(fileName.compare(0, 2, "0x") == 0) {
+    // named by offset, written as is like the installer does
+    job.entry = {strtoull(fileName.c_str() + 2, nullptr, 16), data.size(), data.size(), 0, 0, ""};
+    job.payload = std::move(data);
+    return;
+  }
+  std::array<u64, 3> fileData = offsets.getKey(job.arcPath);
+  u64 compSize = fileData[1];
+  u64 decompSize = fileData[2];
+  if(fileData[0] == 0) {
+    job.error = "not found in Offsets.txt";
+    return;
+  }
+  job.entry = {fileData[0], compSize, decompSize, 0, 0, job.arcPath};
+  if(ZSTD_isFrame(data.data(), data.size())) {
+    // already compressed mods are repacked so that they fill the region exactly
+    unsigned long long size = ZSTD_getFrameContentSize(data.data(), data.size());
+    if(size == ZSTD_CONTENTSIZE_ERROR || size == ZSTD_CONTENTSIZE_UNKNOWN || size > decompSize) {
+      job.error = "is a zstd frame of unknown or too large size";
+      return;
+    }
+    std::vector<char> raw(size);
+    if(ZSTD_isError(ZSTD_decompressDCtx(dctx, raw.data(), raw.size(), data.data(), data.size()))) {
+      job.error = "is a corrupt zstd frame";
+      return;
+    }
+    data = std::move(raw);
+  }
+  if(data.size() > decompSize) {
+    job.error = "is larger than the expected uncompressed size";
+    return;
+  }
+  if(compSize == decompSize) {
+    job.entry.compSize = data.size();
+    job.payload = std::move(data);
+    return;
+  }
+  u64 realCompSize;
+  std::vector<char> compBuf(compSize + 1);
+  if(!compressFrame(cctx, data.data(), data.size(), compBuf.data(), compSize, realCompSize)) {
+    job.error = "does not compress below compSize";
+    return;
+  }
+  job.payload.resize(compSize);
+  padFrame(compBuf.data(), realCompSize, compSize, job.payload.data());
+  if(!frameMatches(dctx, job.payload.data(), compSize, data.data(), data.size()))
+    job.error = "failed verification after padding";
+}
+
+// Writes a patch from vanillaPath to moddedPath, checked by applying it again
+int writePatch(const char* vanillaPath, const char* moddedPath, const char* outPath) {
+  std::vector<char> vanilla = readFile(vanillaPath);
+  std::vector<char> modded = readFile(moddedPath);
+  if(vanilla.empty() || modded.empty()) {
+    fprintf(stderr, "Failed to read %s\n", vanilla.empty() ? vanillaPath : moddedPath);
+    return 1;
+  }
+  if(ZSTD_isFrame(vanilla.data(), vanilla.size()) || ZSTD_isFrame(modded.data(), modded.size())) {
+    fprintf(stderr, "%s is compressed, patches are made from uncompressed files\n",
+            ZSTD_isFrame(vanilla.data(), vanilla.size()) ? vanillaPath : moddedPath);
+    return 1;
+  }
+  std::vector<char> patch = makePatch(vanilla.data(), vanilla.size(), modded.data(), modded.size());
+  std::vector<char> applied;
+  if(patch.empty() || !applyPatch(vanilla.data(), vanilla.size(), patch.data(), patch.size(), modded.size(), applied) ||
+     applied != modded) {
+    fprintf(stderr, "Failed to make a patch from %s to %s\n", vanillaPath, moddedPath);
+    return 1;
+  }
+  FILE* f = fopen(outPath, "wb");
+  bool written = f != nullptr && fwrite(patch.data(), 1, patch.size(), f) == patch.size();
+  if(f != nullptr) written &= fclose(f) == 0;
+  if(!written) {
+    fprintf(stderr, "Failed to write %s\n", outPath);
+    return 1;
+  }
+  printf("%s: %zu bytes, patch %zu bytes\n", outPath, modded.size(), patch.size());
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  if(argc > 1 && strcmp(argv[1], "-p") == 0) {
+    if(argc == 5) return writePatch(argv[2], argv[3], argv[4]);
+    fprintf(stderr, "usage: %s -p <vanilla file> <modded file> <out.ummpatch>\n", argv[0]);
+    return 1;
+  }
+  unsigned threads = std::thread::hardware_concurrency();
+  std::string outFile, outDir;
+  int arg = 1;
+  for(; arg < argc && argv[arg][0] == '-'; arg++) {
+    if(strcmp(argv[arg], "-j") == 0 && arg + 1 < argc) threads = atoi(argv[++arg]);
+    else if(strcmp(argv[arg], "-o") == 0 && arg + 1 < argc) outFile = argv[++arg];
+    else if(strcmp(argv[arg], "-d") == 0 && arg + 1 < argc) outDir = argv[++arg];
+    else break;
+  }
+  if(argc - arg != 2) {
+    fprintf(stderr, "usage: %s [-j threads] [-o mod.umm | -d outdir] Offsets.txt <mod folder>\n"
+                    "       %s -p <vanilla file> <modded file> <out.ummpatch>\n", argv[0], argv[0]);
+    return 1;
+  }
+  if(threads == 0) threads = 1;
+  fs::path modDir = fs::path(argv[arg + 1]).lexically_normal();
+  if(modDir.filename().empty()) modDir = modDir.parent_path();
+  if(outFile.empty() && outDir.empty()) outFile = modDir.string() + UMM_EXT;
+  if(!fs::is_directory(modDir)) {
+    fprintf(stderr, "%s is not a folder\n", modDir.c_str());
+    return 1;
+  }
+  offsetFile offsets(argv[arg]);
+
+  std::vector<packJob> jobs;
+  for(const fs::directory_entry& file : fs::recursive_directory_iterator(modDir)) {
+    if(!file.is_regular_file()) continue;
+    std::string arcPath = fs::relative(file.path(), modDir).generic_string();
+    if(isPatchFile(arcPath)) {
+      fprintf(stderr, "%s: patches need the console's data.arc, skipped\n", arcPath.c_str());
+      continue;
+    }
+    packJob job;
+    job.filePath = file.path().string();
+    job.arcPath = arcPath;
+    jobs.push_back(std::move(job));
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  std::atomic<size_t> next(0);
+  std::vector<std::thread> workers;
+  for(unsigned i = 0; i < threads; i++) {
+    workers.emplace_back([&]() {
+      ZSTD_CCtx* cctx = ZSTD_createCCtx();
+      ZSTD_DCtx* dctx = ZSTD_createDCtx();
+      for(size_t j = next++; j < jobs.size(); j = next++)
+        packFile(jobs[j], offsets, cctx, dctx);
+      ZSTD_freeCCtx(cctx);
+      ZSTD_freeDCtx(dctx);
+    });
+  }
+  for(std::thread& worker : workers) worker.join();
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  std::vector<ummEntry> entries;
+  std::vector<const char*> payloads;
+  u64 inBytes = 0, outBytes = 0;
+  size_t failures = 0;
+  for(packJob& job : jobs) {
+    if(!job.error.empty()) {
+      fprintf(stderr, "%s %s\n", job.arcPath.c_str(), job.error.c_str());
+      failures++;
+      continue;
+    }
+    inBytes += fs::file_size(job.filePath);
+    outBytes += job.payload.size();
+    entries.push_back(job.entry);
+    payloads.push_back(job.payload.data());
+  }
+
+  bool written = true;
+  if(!outDir.empty()) {
+    fs::create_directories(outDir);
+    char name[0x20];
+    for(size_t i = 0; i < entries.size(); i++) {
+      snprintf(name, sizeof(name), "0x%llx", (unsigned long long)entries[i].offset);
+      FILE* f = fopen((fs::path(outDir) / name).c_str(), "wb");
+      written &= f != nullptr && fwrite(payloads[i], 1, entries[i].compSize, f) == entries[i].compSize;
+      if(f != nullptr) fclose(f);
+    }
+  }
+  else written = writeUmmPackage(outFile, entries, payloads);
+  if(!written) {
+    fprintf(stderr, "Failed to write %s\n", outDir.empty() ? outFile.c_str() : outDir.c_str());
+    return 1;
+  }
+
+  printf("%zu file(s) packed, %zu failed, %.1f MiB in, %.1f MiB out, %.2f s on %u thread(s)\n",
+         entries.size(), failures, inBytes / 1048576.0, outBytes / 1048576.0, seconds, threads);
+  return failures > 0 ? 2 : 0;
+}
@@ -0,0 +1,306 @@
+#pragma once
+#include <switch.h>
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#define ZSTD_STATIC_LINKING_ONLY
+#include <zstd.h>
+
+#define BACKUP_COMPRESSION_OFF 0
+#define BACKUP_COMPRESSION_ON 1
+#define BACKUP_COMPRESSION_AUTO 2
+
+#define BACKUP_CHUNK_SIZE 0x100000
+#define BACKUP_CHUNK_RAW 0x80000000  // set in an index entry when the chunk is stored uncompressed
+#define BACKUP_COMP_LEVEL 1
+
+/*
+ * Compressed backup layout:
+ *   compBackupHeader
+ *   u32 index[numChunks]  // stored size of each chunk, BACKUP_CHUNK_RAW flag if uncompressed
+ *   chunk data, each chunk an independent zstd frame of up to chunkSize raw bytes
+ * Raw backups have no header at all, so both kinds share the same 0x<offset>.backup names.
+ */
+const char backupMagic[8] = {'U','M','M','B','K','Z','0','1'};
+
+struct compBackupHeader {
+  char magic[8];
+  u64 rawSize;
+  u32 chunkSize;
+  u32 numChunks;
+};
+
+int backupCompression = BACKUP_COMPRESSION_OFF;
+ZSTD_CCtx* backupCContext = nullptr;
+ZSTD_DCtx* backupDContext = nullptr;
+
+// Running throughput estimates in bytes per second, used to decide per entry in auto mode
+double sdWriteRate = 15e6;
+double backupCompRate = 0;
+
+u64 backupsCompressed = 0;
+u64 backupsStoredRaw = 0;
+u64 backupBytesSaved = 0;
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void updateRate(double& rate, u64 bytes, double seconds) {
+  if(bytes < 0x10000 || seconds <= 0) return;  // too small to say anything
+  double sample = bytes / seconds;
+  rate = (rate == 0) ? sample : (rate * 0.75 + sample * 0.25);
+}
+
+bool readBackupHeader(FILE* f, compBackupHeader& header) {
+  fseek(f, 0, SEEK_SET);
+  if(fread(&header, sizeof(header), 1, f) != 1) return false;
+  return memcmp(header.magic, backupMagic, sizeof(backupMagic)) == 0;
+}
+
+bool isCompressedBackup(const char* path) {
+  compBackupHeader header;
+  FILE* f = fopen(path, "rb");
+  if(!f) return false;
+  bool ret = readBackupHeader(f, header);
+  fclose(f);
+  return ret;
+}
+
+// Size of the arc region a backup covers, for either backup format
+u64 backupRawSize(const char* path) {
+  compBackupHeader header;
+  FILE* f = fopen(path, "rb");
+  if(!f) return 0;
+  u64 size;
+  if(readBackupHeader(f, header))
+    size = header.rawSize;
+  else {
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+  }
+  fclose(f);
+  return size;
+}
+
+size_t writeRawBackup(const char* buf, u64 size, FILE* backup) {
+  auto start = std::chrono::steady_clock::now();
+  fseek(backup, 0, SEEK_SET);
+  size_t ret = fwrite(buf, sizeof(char), size, backup);
+  updateRate(sdWriteRate, size, secondsSince(start));
+  backupsStoredRaw++;
+  return ret;
+}
+
+// Writes the region either raw or compressed, depending on backupCompression.
+// In auto mode the first chunk is compressed as a probe, and the rest is only compressed
+// if the SD write time it saves is larger than the CPU time it costs.
+bool writeBackup(const char* buf, u64 size, FILE* backup) {
+  if(backupCompression == BACKUP_COMPRESSION_OFF || size == 0)
+    return writeRawBackup(buf, size, backup) == size;
+
+  if(backupCContext == nullptr) backupCContext = ZSTD_createCCtx();
+  u32 numChunks = (size + BACKUP_CHUNK_SIZE - 1) / BACKUP_CHUNK_SIZE;
+  u64 headerSize = sizeof(compBackupHeader) + numChunks * sizeof(u32);
+  size_t boundSize = ZSTD_compressBound(BACKUP_CHUNK_SIZE);
+  char* compBuf = new char[boundSize];
+  u32* index = new u32[numChunks];
+  u64 storedSize = headerSize;
+  bool ret = true;
+
+  for(u32 i = 0; i < numChunks; i++) {
+    u64 chunkOffset = (u64)i * BACKUP_CHUNK_SIZE;
+    u64 chunkSize = std::min((u64)BACKUP_CHUNK_SIZE, size - chunkOffset);
+    auto start = std::chrono::steady_clock::now();
+    size_t compSize = ZSTD_compressCCtx(backupCContext, compBuf, boundSize, buf + chunkOffset, chunkSize, BACKUP_COMP_LEVEL);
+    double compTime = secondsSince(start);
+    updateRate(backupCompRate, chunkSize, compTime);
+    const char* chunkData = compBuf;
+    if(ZSTD_isError(compSize) || compSize >= chunkSize) {
+      compSize = chunkSize;
+      chunkData = buf + chunkOffset;
+      index[i] = chunkSize | BACKUP_CHUNK_RAW;
+    }
+    else index[i] = compSize;
+
+    if(i == 0) {
+      double ratio = (double)compSize / chunkSize;
+      double savedTime = (size * (1 - ratio) - headerSize) / sdWriteRate;
+      double cpuTime = (size - chunkSize) / (backupCompRate > 0 ? backupCompRate : chunkSize / std::max(compTime, 1e-6));
+      if(backupCompression == BACKUP_COMPRESSION_AUTO && savedTime <= cpuTime) {
+        ret = writeRawBackup(buf, size, backup) == size;
+        goto end;
+      }
+      compBackupHeader header;
+      memcpy(header.magic, backupMagic, sizeof(backupMagic));
+      header.rawSize = size;
+      header.chunkSize = BACKUP_CHUNK_SIZE;
+      header.numChunks = numChunks;
+      fseek(backup, 0, SEEK_SET);
+      fwrite(&header, sizeof(header), 1, backup);
+      fseek(backup, headerSize, SEEK_SET);  // index is filled in once all chunks are written
+    }
+    auto writeStart = std::chrono::steady_clock::now();
+    if(fwrite(chunkData, sizeof(char), compSize, backup) != compSize) {
+      ret = false;
+      goto end;
+    }
+    updateRate(sdWriteRate, compSize, secondsSince(writeStart));
+    storedSize += compSize;
+  }
+  fseek(backup, sizeof(compBackupHeader), SEEK_SET);
+  ret = fwrite(index, sizeof(u32), numChunks, backup) == numChunks;
+  backupsCompressed++;
+  backupBytesSaved += size - std::min(size, storedSize);
+
+end:
+  delete[] index;
+  delete[] compBuf;
+  return ret;
+}
+
+// Reads and checks the chunk index that follows header. Returns nullptr if the header does
+// not describe rawSize in chunkSize chunks or the chunks do not add up to the file's size,
+// so a truncated or damaged backup is caught before anything is written from it.
+u32* readBackupIndex(FILE* f, const compBackupHeader& header) {
+  if(header.chunkSize == 0 || header.chunkSize > BACKUP_CHUNK_SIZE ||
+     header.numChunks != (header.rawSize + header.chunkSize - 1) / header.chunkSize)
+    return nullptr;
+  u32* index = new u32[header.numChunks];
+  u64 expected = sizeof(compBackupHeader) + (u64)header.numChunks * sizeof(u32);
+  bool ok = fseek(f, sizeof(compBackupHeader), SEEK_SET) == 0 &&
+            fread(index, sizeof(u32), header.numChunks, f) == header.numChunks;
+  for(u32 i = 0; i < header.numChunks && ok; i++) {
+    u32 storedSize = index[i] & ~BACKUP_CHUNK_RAW;
+    u64 chunkSize = std::min((u64)header.chunkSize, header.rawSize - (u64)i * header.chunkSize);
+    if(storedSize > ZSTD_compressBound(header.chunkSize) || ((index[i] & BACKUP_CHUNK_RAW) && storedSize != chunkSize))
+      ok = false;
+    expected += storedSize;
+  }
+  if(ok) {
+    long pos = ftell(f);
+    ok = fseek(f, 0, SEEK_END) == 0 && (u64)ftell(f) == expected && fseek(f, pos, SEEK_SET) == 0;
+  }
+  if(!ok) {
+    delete[] index;
+    return nullptr;
+  }
+  return index;
+}
+
+// Writes the region stored in a compressed backup back to the arc at offset. Every chunk
+// is decompressed once before anything is written, so a damaged backup leaves the arc alone.
+int restoreCompressedBackup(const char* path, u64 offset, FILE* arc) {
+  FILE* f = fopen(path, "rb");
+  compBackupHeader header;
+  if(!f || !readBackupHeader(f, header)) {
+    if(f) fclose(f);
+    printf(CONSOLE_RED "Failed to read compressed backup '%s'\n" CONSOLE_RESET, path);
+    return -1;
+  }
+  u32* index = readBackupIndex(f, header);
+  if(index == nullptr) {
+    fclose(f);
+    printf(CONSOLE_RED "Compressed backup '%s' is damaged\n" CONSOLE_RESET, path);
+    return -1;
+  }
+  if(backupDContext == nullptr) backupDContext = ZSTD_createDCtx();
+  char* inBuf = new char[ZSTD_compressBound(header.chunkSize)];
+  char* outBuf = new char[header.chunkSize];
+  long chunksStart = ftell(f);
+  int ret = 0;
+  for(int pass = 0; pass < 2 && ret == 0; pass++) {
+    bool write = pass == 1;
+    u64 restored = 0;
+    fseek(f, chunksStart, SEEK_SET);
+    if(write) fseek(arc, offset, SEEK_SET);
+    for(u32 i = 0; i < header.numChunks; i++) {
+      u32 storedSize = index[i] & ~BACKUP_CHUNK_RAW;
+      u64 chunkSize = std::min((u64)header.chunkSize, header.rawSize - restored);
+      if(fread(inBuf, sizeof(char), storedSize, f) != storedSize) {
+        ret = -1;
+        break;
+      }
+      const char* chunk = inBuf;
+      if(!(index[i] & BACKUP_CHUNK_RAW)) {
+        size_t outSize = ZSTD_decompressDCtx(backupDContext, outBuf, header.chunkSize, inBuf, storedSize);
+        if(ZSTD_isError(outSize) || outSize != chunkSize) {
+          ret = -1;
+          break;
+        }
+        chunk = outBuf;
+      }
+      if(write && fwrite(chunk, sizeof(char), chunkSize, arc) != chunkSize) {
+        printf(CONSOLE_RED "Failed to write '%s' to data.arc\n" CONSOLE_RESET, path);
+        ret = -2;
+        break;
+      }
+      restored += chunkSize;
+    }
+    if(ret == 0 && restored != header.rawSize) ret = -1;
+  }
+  if(ret == -1) printf(CONSOLE_RED "Compressed backup '%s' is damaged\n" CONSOLE_RESET, path);
+  delete[] outBuf;
+  delete[] inBuf;
+  delete[] index;
+  fclose(f);
+  return ret;
+}
+
+// Reads the region stored in a backup of either format into out, which must hold rawSize bytes
+bool readBackup(const char* path, char* out, u64 rawSize) {
+  FILE* f = fopen(path, "rb");
+  if(!f) return false;
+  compBackupHeader header;
+  if(!readBackupHeader(f, header)) {
+    fseek(f, 0, SEEK_SET);
+    bool ret = fread(out, sizeof(char), rawSize, f) == rawSize;
+    fclose(f);
+    return ret;
+  }
+  if(header.rawSize != rawSize) {
+    fclose(f);
+    return false;
+  }
+  u32* index = readBackupIndex(f, header);
+  if(index == nullptr) {
+    fclose(f);
+    return false;
+  }
+  if(backupDContext == nullptr) backupDContext = ZSTD_createDCtx();
+  size_t inCap = ZSTD_compressBound(header.chunkSize);
+  char* inBuf = new char[inCap];
+  u64 pos = 0;
+  bool ret = true;
+  for(u32 i = 0; i < header.numChunks && ret; i++) {
+    u32 storedSize = index[i] & ~BACKUP_CHUNK_RAW;
+    u64 chunkSize = std::min((u64)header.chunkSize, rawSize - pos);
+    if(storedSize > inCap || fread(inBuf, sizeof(char), storedSize, f) != storedSize)
+      ret = false;
+    else if(index[i] & BACKUP_CHUNK_RAW) {
+      if(storedSize != chunkSize) ret = false;
+      else memcpy(out + pos, inBuf, storedSize);
+      pos += chunkSize;
+    }
+    else {
+      size_t outSize = ZSTD_decompressDCtx(backupDContext, out + pos, chunkSize, inBuf, storedSize);
+      if(ZSTD_isError(outSize) || outSize != chunkSize) ret = false;
+      else pos += outSize;
+    }
+  }
+  delete[] inBuf;
+  delete[] index;
+  fclose(f);
+  return ret && pos == rawSize;
+}
+
+void freeBackupContexts() {
+  if(backupCContext != nullptr) {
+    ZSTD_freeCCtx(backupCContext);
+    backupCContext = nullptr;
+  }
+  if(backupDContext != nullptr) {
+    ZSTD_freeDCtx(backupDContext);
+    backupDContext = nullptr;
+  }
+}
@@ -0,0 +1,194 @@
+#pragma once
+#include <switch.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <string>
+
+/*
+ * How compressing mod files to fit their regions goes, for tuning the levels tried.
+ * Every level attempt is counted, and once a file is done, how many attempts it took, the
+ * level that fit and how much of the region the frame fills. Kept for the current install
+ * and added to a running total on the SD card after each one.
+ */
+#define COMP_STATS_VERSION "UMM compression stats v1"
+#define COMP_STATS_TRIES 12  // the last bucket also counts anything above
+#define COMP_STATS_FILL 10   // frame size relative to compSize, in 10% steps
+
+// Compression attempts at one zstd level
+struct levelTotal {
+  u64 attempts;
+  u64 fits;      // attempts that fit the region
+  u64 inBytes;
+  u64 outBytes;
+  double seconds;
+};
+
+struct compressionStats {
+  std::map<int, levelTotal> levels;
+  std::map<int, u64> finalLevels;     // files by the level that fit
+  u64 tries[COMP_STATS_TRIES + 1];    // files by number of attempts
+  u64 fill[COMP_STATS_FILL];          // files that fit, by how full they leave the region
+  u64 files;
+  u64 failed;                         // files that did not fit at any level
+  u64 inBytes;
+  u64 outBytes;                       // frame sizes of the files that fit
+  u64 regionBytes;                    // compSize of the files that fit
+};
+
+compressionStats installCompression;
+int fileAttempts = 0;  // attempts since the last finished file
+int fileLevel = 0;
+
+void clearCompressionStats(compressionStats& stats) {
+  stats = compressionStats();
+}
+
+void countFrameAttempt(int level, u64 inSize, u64 outSize, bool fits, double seconds) {
+  levelTotal& total = installCompression.levels[level];
+  total.attempts++;
+  total.fits += fits;
+  total.inBytes += inSize;
+  total.outBytes += outSize;
+  total.seconds += seconds;
+  fileAttempts++;
+  fileLevel = level;
+}
+
+// Called once a file has been compressed, or has failed to, after its attempts were counted.
+// frameSize is 0 if no level fit.
+void countCompressedFile(u64 inSize, u64 frameSize, u64 compSize) {
+  compressionStats& stats = installCompression;
+  stats.files++;
+  stats.inBytes += inSize;
+  stats.tries[std::min(fileAttempts, COMP_STATS_TRIES)]++;
+  if(frameSize == 0 || frameSize > compSize)
+    stats.failed++;
+  else {
+    stats.finalLevels[fileLevel]++;
+    stats.fill[std::min((int)(frameSize * COMP_STATS_FILL / std::max(compSize, (u64)1)), COMP_STATS_FILL - 1)]++;
+    stats.outBytes += frameSize;
+    stats.regionBytes += compSize;
+  }
+  fileAttempts = 0;
+  fileLevel = 0;
+}
+
+void addCompressionStats(compressionStats& to, const compressionStats& from) {
+  for(auto& [level, total] : from.levels) {
+    levelTotal& sum = to.levels[level];
+    sum.attempts += total.attempts;
+    sum.fits += total.fits;
+    sum.inBytes += total.inBytes;
+    sum.outBytes += total.outBytes;
+    sum.seconds += total.seconds;
+  }
+  for(auto& [level, count] : from.finalLevels)
+    to.finalLevels[level] += count;
+  for(int i = 0; i <= COMP_STATS_TRIES; i++)
+    to.tries[i] += from.tries[i];
+  for(int i = 0; i < COMP_STATS_FILL; i++)
+    to.fill[i] += from.fill[i];
+  to.files += from.files;
+  to.failed += from.failed;
+  to.inBytes += from.inBytes;
+  to.outBytes += from.outBytes;
+  to.regionBytes += from.regionBytes;
+}
+
+void loadCompressionStats(const char* path, compressionStats& stats) {
+  clearCompressionStats(stats);
+  FILE* f = fopen(path, "r");
+  if(!f) return;
+  char line[0x100];
+  bool current = fgets(line, sizeof(line), f) && strncmp(line, COMP_STATS_VERSION "\n", sizeof(COMP_STATS_VERSION)) == 0;
+  while(current && fgets(line, sizeof(line), f)) {
+    int key;
+    u64 count;
+    levelTotal total;
+    if(sscanf(line, "files %lu %lu %lu %lu %lu", &stats.files, &stats.failed, &stats.inBytes, &stats.outBytes, &stats.regionBytes) == 5)
+      continue;
+    if(sscanf(line, "level %d %lu %lu %lu %lu %lf", &key, &total.attempts, &total.fits, &total.inBytes, &total.outBytes,
+              &total.seconds) == 6)
+      stats.levels[key] = total;
+    else if(sscanf(line, "final %d %lu", &key, &count) == 2)
+      stats.finalLevels[key] = count;
+    else if(sscanf(line, "tries %d %lu", &key, &count) == 2 && key >= 0 && key <= COMP_STATS_TRIES)
+      stats.tries[key] = count;
+    else if(sscanf(line, "fill %d %lu", &key, &count) == 2 && key >= 0 && key < COMP_STATS_FILL)
+      stats.fill[key] = count;
+  }
+  fclose(f);
+}
+
+bool saveCompressionStats(const char* path, const compressionStats& stats) {
+  FILE* f = fopen(path, "w");
+  if(!f) return false;
+  fprintf(f, COMP_STATS_VERSION "\n");
+  fprintf(f, "files %lu %lu %lu %lu %lu\n", stats.files, stats.failed, stats.inBytes, stats.outBytes, stats.regionBytes);
+  for(auto& [level, total] : stats.levels)
+    fprintf(f, "level %d %lu %lu %lu %lu %.3f\n", level, total.attempts, total.fits, total.inBytes, total.outBytes, total.seconds);
+  for(auto& [level, count] : stats.finalLevels)
+    fprintf(f, "final %d %lu\n", level, count);
+  for(int i = 0; i <= COMP_STATS_TRIES; i++)
+    if(stats.tries[i]) fprintf(f, "tries %d %lu\n", i, stats.tries[i]);
+  for(int i = 0; i < COMP_STATS_FILL; i++)
+    if(stats.fill[i]) fprintf(f, "fill %d %lu\n", i, stats.fill[i]);
+  fclose(f);
+  return true;
+}
+
+// The "compression" object of the install report
+void writeCompressionJSON(FILE* f, const compressionStats& stats) {
+  fprintf(f, "{\"files\": %lu, \"failed\": %lu, \"inBytes\": %lu, \"outBytes\": %lu, \"regionBytes\": %lu,\n",
+          stats.files, stats.failed, stats.inBytes, stats.outBytes, stats.regionBytes);
+  fprintf(f, "    \"levels\": [");
+  bool first = true;
+  for(auto& [level, total] : stats.levels) {
+    fprintf(f, "%s\n      {\"level\": %d, \"attempts\": %lu, \"fits\": %lu, \"inBytes\": %lu, \"outBytes\": %lu, \"seconds\": %.3f}",
+            first ? "" : ",", level, total.attempts, total.fits, total.inBytes, total.outBytes, total.seconds);
+    first = false;
+  }
+  fprintf(f, "\n    ],\n    \"finalLevels\": {");
+  first = true;
+  for(auto& [level, count] : stats.finalLevels) {
+    fprintf(f, "%s\"%d\": %lu", first ? "" : ", ", level, count);
+    first = false;
+  }
+  fprintf(f, "},\n    \"tries\": [");
+  for(int i = 0; i <= COMP_STATS_TRIES; i++)
+    fprintf(f, "%s%lu", i ? ", " : "", stats.tries[i]);
+  fprintf(f, "],\n    \"fill\": [");
+  for(int i = 0; i < COMP_STATS_FILL; i++)
+    fprintf(f, "%s%lu", i ? ", " : "", stats.fill[i]);
+  fprintf(f, "]}");
+}
+
+// Prints the current install's numbers and adds them to the totals in path
+void finishCompressionStats(const char* path) {
+  compressionStats& stats = installCompression;
+  if(stats.files > 0) {
+    u64 attempts = 0;
+    for(auto& [level, total] : stats.levels)
+      attempts += total.attempts;
+    printf("Compressed %lu file(s), %.1f attempt(s) each, final levels", stats.files, (double)attempts / stats.files);
+    for(auto& [level, count] : stats.finalLevels)
+      printf(" %d:%lu", level, count);
+    printf("\n");
+    if(stats.regionBytes > 0)
+      printf("Frames fill %.1f%% of their regions, %lu KiB of padding\n", 100.0 * stats.outBytes / stats.regionBytes,
+             (stats.regionBytes - stats.outBytes) / 1024);
+    if(stats.failed > 0)
+      printf(CONSOLE_YELLOW "%lu file(s) did not fit at any level\n" CONSOLE_RESET, stats.failed);
+
+    compressionStats totals;
+    loadCompressionStats(path, totals);
+    addCompressionStats(totals, stats);
+    if(!saveCompressionStats(path, totals))
+      printf(CONSOLE_RED "Failed to write %s\n" CONSOLE_RESET, path);
+  }
+  clearCompressionStats(stats);
+  fileAttempts = 0;
+  fileLevel = 0;
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include <map>
+#include <string>
+#include <fstream>
+
+// Simple "key=value" settings file. Lines starting with '#' are comments.
+class configFile
+{
+private:
+  std::map<std::string, std::string> values;
+public:
+  configFile(std::string configPath)
+  {
+    std::ifstream config(configPath);
+    std::string line;
+    while(getline(config, line)) {
+      if(line.empty() || line[0] == '#') continue;
+      size_t eqIDX = line.find('=');
+      if(eqIDX == std::string::npos) continue;
+      std::string key = line.substr(0, eqIDX);
+      std::string value = line.substr(eqIDX+1);
+      key.erase(key.find_last_not_of(" \t\r") + 1);
+      value.erase(0, value.find_first_not_of(" \t"));
+      value.erase(value.find_last_not_of(" \t\r") + 1);
+      values[key] = value;
+    }
+  }
+  std::string getString(std::string key, std::string defaultValue)
+  {
+    auto it = values.find(key);
+    if (it != values.end())
+      return it->second;
+    return defaultValue;
+  }
+  long getInt(std::string key, long defaultValue)
+  {
+    auto it = values.find(key);
+    if (it != values.end() && !it->second.empty())
+      return strtol(it->second.c_str(), NULL, 0);
+    return defaultValue;
+  }
+  bool getBool(std::string key, bool defaultValue)
+  {
+    auto it = values.find(key);
+    if (it != values.end())
+      return it->second == "1" || it->second == "true" || it->second == "on";
+    return defaultValue;
+  }
+};
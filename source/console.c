@@ -16,8 +16,10 @@
 #define CONSOLE_HEIGHT 45
 #endif
 
+#if defined(_3DS) || defined(__SWITCH__)
 static PrintConsole status_console;
 static PrintConsole main_console;
+#endif
 #if ENABLE_LOGGING
 static bool disable_logging = false;
 #endif
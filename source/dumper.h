@@ -67,8 +67,13 @@ void copy(const char* from, const char* to, bool exfat = false)
       printf(CONSOLE_RED "\nNo applet mode.\nYou must override Smash for this application to work properly.\nHold 'R' while launching Smash to do so." CONSOLE_RESET);
       return;
     }
-    std::string backups = "/UltimateModManager/backups";
+    std::string backups = "sdmc:/UltimateModManager/backups";
     if(std::filesystem::exists(backups)) removeRecursive(backups);
+    // what the installer recorded about the old data.arc no longer holds for the new one
+    remove("sdmc:/UltimateModManager/installed.txt");
+    remove("sdmc:/UltimateModManager/install.journal");
+    remove("sdmc:/UltimateModManager/install.checkpoint");
+    remove("sdmc:/UltimateModManager/profiles/active");
     remove(outPath.c_str());
     romfsMountFromCurrentProcess("romfs");
     FILE* source = fopen(from, "rb");
@@ -83,7 +88,7 @@ void copy(const char* from, const char* to, bool exfat = false)
     u64 size = ftell(source);
     fseek(source, 0, SEEK_SET);
 
-    if(std::filesystem::space(to).available < size)
+    if(std::filesystem::space("sdmc:/").available < size)
     {
       printf(CONSOLE_RED "\nNot enough storage space on the SD card." CONSOLE_RESET);
       fclose(source);
@@ -0,0 +1,90 @@
+#pragma once
+#include <switch.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "installManifest.h"
+
+/*
+ * Checkpoint of the regions an install has finished, so an interrupted install can resume.
+ * The manifest is only saved once an install ends, this file carries its changes until then:
+ *   S <offset>,<size>,<written>,<srcSize>,<srcMtime>,<srcHash>,<frameHash>,<backup>,<source>
+ *   E <offset> <size>
+ * S is appended after journalEnd() for a region written from a mod, with the number of bytes
+ * frameHash covers and whether the region had a backup. E is appended for a restored region.
+ * Lines are not synced on their own, a line lost to a power cut only means that region is
+ * written again.
+ */
+const char* checkpointPath = "sdmc:/UltimateModManager/install.checkpoint";
+FILE* checkpoint = nullptr;
+
+#define CHECKPOINT_SET 'S'
+#define CHECKPOINT_ERASE 'E'
+
+struct checkpointRecord {
+    char type;
+    u64 offset;
+    u64 written;   // bytes at offset covered by entry.frameHash
+    bool backup;
+    manifestEntry entry;  // only size is set for CHECKPOINT_ERASE
+};
+
+void checkpointOpen() {
+    checkpoint = fopen(checkpointPath, "ab");
+    if(!checkpoint) printf(CONSOLE_RED "Failed to open install checkpoint\n" CONSOLE_RESET);
+}
+
+// Kept when the manifest could not be saved, so the next recovery can still apply it
+void checkpointClose(bool manifestSaved) {
+    if(checkpoint) {
+        fclose(checkpoint);
+        checkpoint = nullptr;
+    }
+    if(manifestSaved) remove(checkpointPath);
+}
+
+void checkpointSet(u64 offset, const manifestEntry& entry, u64 written, bool backup) {
+    if(!checkpoint) return;
+    fprintf(checkpoint, "%c %lx,%lx,%lx,%lx,%lx,%lx,%lx,%d,%s\n", CHECKPOINT_SET, offset, entry.size, written,
+            entry.srcSize, entry.srcMtime, entry.srcHash, entry.frameHash, backup, entry.source.c_str());
+    fflush(checkpoint);
+}
+
+void checkpointErase(u64 offset, u64 size) {
+    if(!checkpoint) return;
+    fprintf(checkpoint, "%c %lx %lx\n", CHECKPOINT_ERASE, offset, size);
+    fflush(checkpoint);
+}
+
+// Returns the recorded regions in the order they finished
+std::vector<checkpointRecord> checkpointRecords() {
+    std::vector<checkpointRecord> records;
+    FILE* f = fopen(checkpointPath, "rb");
+    if(!f) return records;
+    char line[0x400];
+    while(fgets(line, sizeof(line), f)) {
+        size_t len = strlen(line);
+        if(len == 0 || line[len-1] != '\n') continue;  // torn last line
+        line[len-1] = 0;
+        checkpointRecord record = {};
+        record.type = line[0];
+        if(record.type == CHECKPOINT_ERASE) {
+            if(sscanf(line + 1, "%lx %lx", &record.offset, &record.entry.size) == 2)
+                records.push_back(record);
+            continue;
+        }
+        int backup = 0, sourceIDX = 0;
+        if(record.type != CHECKPOINT_SET ||
+           sscanf(line + 1, "%lx,%lx,%lx,%lx,%lx,%lx,%lx,%d,%n", &record.offset, &record.entry.size, &record.written,
+                  &record.entry.srcSize, &record.entry.srcMtime, &record.entry.srcHash, &record.entry.frameHash,
+                  &backup, &sourceIDX) < 8 || sourceIDX == 0)
+            continue;
+        record.backup = backup != 0;
+        record.entry.written = record.written;
+        record.entry.source = line + 1 + sourceIDX;
+        records.push_back(record);
+    }
+    fclose(f);
+    return records;
+}
@@ -0,0 +1,156 @@
+#pragma once
+#include <switch.h>
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+#define ZSTD_STATIC_LINKING_ONLY
+#include <zstd.h>
+
+#define ESTIMATE_SAMPLE_SIZE 0x10000
+#define ESTIMATE_SAMPLE_COUNT 3
+#define ESTIMATE_SAMPLE_LEVEL 3
+// Levels above the first attempt are much slower, see compressFile
+#define ESTIMATE_RETRY_COST 6.0
+#define SD_READ_RATE 40e6
+
+// What a dry run predicts for one mod file
+struct fileEstimate {
+  std::string path;
+  u64 offset;
+  u64 regionSize;
+  u64 modSize;
+  u64 predictedSize;  // expected compressed size, 0 if written as is
+  double seconds;
+  const char* action;  // "copy", "compress", "patch", "unchanged" or "fail"
+  std::string problem;
+};
+
+struct installEstimate {
+  std::vector<fileEstimate> files;
+  u64 readBytes = 0;
+  u64 writeBytes = 0;
+  u64 backupBytes = 0;
+  u64 compressBytes = 0;
+  u64 failures = 0;
+  double compressSeconds = 0;
+  double ioSeconds = 0;
+};
+
+// Compresses a few evenly spaced samples of the file and returns the compression ratio.
+// secondsPerByte receives the measured compression speed.
+double sampleCompression(ZSTD_CCtx* cctx, const char* path, u64 modSize, double& secondsPerByte) {
+  FILE* f = fopen(path, "rb");
+  if(!f || modSize == 0) {
+    if(f) fclose(f);
+    secondsPerByte = 0;
+    return 1;
+  }
+  char* inBuf = new char[ESTIMATE_SAMPLE_SIZE];
+  size_t outCap = ZSTD_compressBound(ESTIMATE_SAMPLE_SIZE);
+  char* outBuf = new char[outCap];
+  u64 sampled = 0, compressed = 0;
+  double seconds = 0;
+  u64 step = modSize > ESTIMATE_SAMPLE_SIZE ? (modSize - ESTIMATE_SAMPLE_SIZE) / (ESTIMATE_SAMPLE_COUNT - 1) : 0;
+  for(int i = 0; i < ESTIMATE_SAMPLE_COUNT; i++) {
+    fseek(f, step * i, SEEK_SET);
+    size_t size = fread(inBuf, 1, ESTIMATE_SAMPLE_SIZE, f);
+    if(size == 0) break;
+    auto start = std::chrono::steady_clock::now();
+    size_t outSize = ZSTD_compressCCtx(cctx, outBuf, outCap, inBuf, size, ESTIMATE_SAMPLE_LEVEL);
+    seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    sampled += size;
+    compressed += ZSTD_isError(outSize) ? size : outSize;
+    if(step == 0) break;  // whole file fits in one sample
+  }
+  delete[] outBuf;
+  delete[] inBuf;
+  fclose(f);
+  secondsPerByte = sampled ? seconds / sampled : 0;
+  return sampled ? (double)compressed / sampled : 1;
+}
+
+// Same as sampleCompression() for a file already in memory
+double sampleBuffer(ZSTD_CCtx* cctx, const char* data, u64 size, double& secondsPerByte) {
+  size_t outCap = ZSTD_compressBound(ESTIMATE_SAMPLE_SIZE);
+  char* outBuf = new char[outCap];
+  u64 sampled = 0, compressed = 0;
+  double seconds = 0;
+  u64 step = size > ESTIMATE_SAMPLE_SIZE ? (size - ESTIMATE_SAMPLE_SIZE) / (ESTIMATE_SAMPLE_COUNT - 1) : 0;
+  for(int i = 0; i < ESTIMATE_SAMPLE_COUNT && size > 0; i++) {
+    size_t sampleSize = std::min((u64)ESTIMATE_SAMPLE_SIZE, size - step * i);
+    auto start = std::chrono::steady_clock::now();
+    size_t outSize = ZSTD_compressCCtx(cctx, outBuf, outCap, data + step * i, sampleSize, ESTIMATE_SAMPLE_LEVEL);
+    seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    sampled += sampleSize;
+    compressed += ZSTD_isError(outSize) ? sampleSize : outSize;
+    if(step == 0) break;
+  }
+  delete[] outBuf;
+  secondsPerByte = sampled ? seconds / sampled : 0;
+  return sampled ? (double)compressed / sampled : 1;
+}
+
+// Fills in the estimate of a file that has to be compressed to fit compSize
+void predictCompression(fileEstimate& file, u64 compSize, double ratio, double secondsPerByte) {
+  file.action = "compress";
+  file.predictedSize = ratio * file.modSize;
+  file.seconds = secondsPerByte * file.modSize;
+  if(file.predictedSize > compSize) {
+    file.seconds *= ESTIMATE_RETRY_COST;
+    if(file.predictedSize > compSize * 1.25)
+      file.problem = "predicted not to compress below compSize";
+  }
+}
+
+void addEstimate(installEstimate& estimate, fileEstimate& file, u64 backupSize, double writeRate) {
+  if(!file.problem.empty() && file.action != std::string("unchanged")) {
+    file.action = "fail";
+    estimate.failures++;
+  }
+  else if(file.action != std::string("unchanged")) {
+    estimate.readBytes += file.modSize + backupSize;
+    estimate.writeBytes += file.regionSize;
+    estimate.backupBytes += backupSize;
+    double io = (double)(file.modSize + backupSize) / SD_READ_RATE + (double)(file.regionSize + backupSize) / writeRate;
+    estimate.ioSeconds += io;
+    if(file.predictedSize) {
+      estimate.compressBytes += file.modSize;
+      estimate.compressSeconds += file.seconds;
+    }
+    file.seconds += io;
+  }
+  estimate.files.push_back(file);
+}
+
+std::string jsonEscape(const std::string& str) {
+  std::string out;
+  for(char c : str) {
+    if(c == '"' || c == '\\') out += '\\';
+    if((unsigned char)c < 0x20) continue;
+    out += c;
+  }
+  return out;
+}
+
+bool writeEstimateJSON(const installEstimate& estimate, const char* path) {
+  FILE* f = fopen(path, "w");
+  if(!f) return false;
+  fprintf(f, "{\n  \"files\": %lu,\n  \"failures\": %lu,\n", estimate.files.size(), estimate.failures);
+  fprintf(f, "  \"readBytes\": %lu,\n  \"writeBytes\": %lu,\n  \"backupBytes\": %lu,\n  \"compressBytes\": %lu,\n",
+          estimate.readBytes, estimate.writeBytes, estimate.backupBytes, estimate.compressBytes);
+  fprintf(f, "  \"compressSeconds\": %.2f,\n  \"ioSeconds\": %.2f,\n  \"estimatedSeconds\": %.2f,\n",
+          estimate.compressSeconds, estimate.ioSeconds, estimate.compressSeconds + estimate.ioSeconds);
+  fprintf(f, "  \"entries\": [");
+  for(size_t i = 0; i < estimate.files.size(); i++) {
+    const fileEstimate& file = estimate.files[i];
+    fprintf(f, "%s\n    {\"path\": \"%s\", \"offset\": %lu, \"regionSize\": %lu, \"modSize\": %lu, \"predictedSize\": %lu, "
+            "\"seconds\": %.3f, \"action\": \"%s\", \"problem\": \"%s\"}", i ? "," : "",
+            jsonEscape(file.path).c_str(), file.offset, file.regionSize, file.modSize, file.predictedSize,
+            file.seconds, file.action, jsonEscape(file.problem).c_str());
+  }
+  fprintf(f, "\n  ]\n}\n");
+  fclose(f);
+  return true;
+}
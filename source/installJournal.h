@@ -0,0 +1,87 @@
+#pragma once
+#include <switch.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <map>
+#include "installTimings.h"
+
+/*
+ * Write-ahead journal for data.arc region writes.
+ * Every region write is bracketed by two lines:
+ *   I <offset> <size>   about to overwrite a region with mod data
+ *   R <offset> <size>   about to restore a region from its backup
+ *   D <offset>          region write finished and flushed
+ * and a line for regions left alone because they could not be backed up first:
+ *   S <offset> <size>   region skipped, its backup failed
+ * A begin record without a matching D means the write was interrupted.
+ */
+const char* journalPath = "sdmc:/UltimateModManager/install.journal";
+FILE* journal = nullptr;
+
+#define JOURNAL_INSTALL 'I'
+#define JOURNAL_RESTORE 'R'
+#define JOURNAL_DONE 'D'
+#define JOURNAL_SKIPPED 'S'
+
+void syncFile(FILE* f) {
+    phaseTimer timer(PHASE_SYNC);
+    fflush(f);
+    fsync(fileno(f));
+}
+
+void journalOpen() {
+    journal = fopen(journalPath, "ab");
+    if(!journal) printf(CONSOLE_RED "Failed to open install journal\n" CONSOLE_RESET);
+}
+
+void journalClose() {
+    if(journal) {
+        fclose(journal);
+        journal = nullptr;
+        remove(journalPath);
+    }
+}
+
+void journalBegin(char type, u64 offset, u64 size) {
+    if(!journal) return;
+    fprintf(journal, "%c %lx %lx\n", type, offset, size);
+    syncFile(journal);
+}
+
+// Only called once the region data has been flushed to data.arc
+void journalEnd(u64 offset, FILE* arc) {
+    if(!journal) return;
+    syncFile(arc);
+    fprintf(journal, "%c %lx\n", JOURNAL_DONE, offset);
+    syncFile(journal);
+}
+
+// A region that was not written because its backup failed, data.arc is unchanged there
+void journalSkip(u64 offset, u64 size) {
+    if(!journal) return;
+    fprintf(journal, "%c %lx %lx\n", JOURNAL_SKIPPED, offset, size);
+    syncFile(journal);
+}
+
+struct journalRecord {
+    char type;
+    u64 size;
+};
+
+// Returns the regions that were started but never finished, by offset
+std::map<u64, journalRecord> journalPending() {
+    std::map<u64, journalRecord> pending;
+    FILE* f = fopen(journalPath, "rb");
+    if(!f) return pending;
+    char type;
+    u64 offset, size;
+    char line[64];
+    while(fgets(line, sizeof(line), f)) {
+        int fields = sscanf(line, "%c %lx %lx", &type, &offset, &size);
+        if(fields < 2 || (type != JOURNAL_DONE && fields < 3)) continue;  // torn last line
+        if(type == JOURNAL_DONE) pending.erase(offset);
+        else if(type == JOURNAL_INSTALL || type == JOURNAL_RESTORE) pending[offset] = {type, size};
+    }
+    fclose(f);
+    return pending;
+}
@@ -0,0 +1,137 @@
+#pragma once
+#include <switch.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <map>
+#include <string>
+#include "xxhash64.h"
+
+#define MANIFEST_VERSION "UMM installed regions v2"
+#define MANIFEST_VERSION_1 "UMM installed regions v1"
+
+// What is currently written to one region of data.arc
+struct manifestEntry {
+  u64 size;          // size of the region in data.arc
+  std::string source;  // mod file the region was written from
+  u64 srcSize;
+  u64 srcMtime;
+  u64 srcHash;       // XXH64 of the mod file
+  u64 frameHash;     // XXH64 of the bytes written to data.arc
+  u64 written;       // bytes at the offset frameHash covers, 0 if not known
+};
+
+class installManifest
+{
+private:
+  std::string manifestPath;
+  bool loaded = false;
+  bool dirty = false;
+public:
+  std::map<u64, manifestEntry> regions;
+
+  installManifest(std::string path) : manifestPath(path) {}
+
+  void load()
+  {
+    if(loaded) return;
+    loaded = true;
+    FILE* f = fopen(manifestPath.c_str(), "r");
+    if(!f) return;
+    char line[0x400];
+    // first line has version info, v1 did not record how much frameHash covers
+    bool v1 = fgets(line, sizeof(line), f) && strncmp(line, MANIFEST_VERSION_1, strlen(MANIFEST_VERSION_1)) == 0;
+    while(fgets(line, sizeof(line), f)) {
+      u64 offset;
+      manifestEntry entry = {};
+      int sourceIDX = 0;
+      if(v1) {
+        if(sscanf(line, "%lx,%lx,%lx,%lx,%lx,%lx,%n", &offset, &entry.size, &entry.srcSize, &entry.srcMtime,
+                  &entry.srcHash, &entry.frameHash, &sourceIDX) < 6 || sourceIDX == 0)
+          continue;
+      }
+      else if(sscanf(line, "%lx,%lx,%lx,%lx,%lx,%lx,%lx,%n", &offset, &entry.size, &entry.srcSize, &entry.srcMtime,
+                     &entry.srcHash, &entry.frameHash, &entry.written, &sourceIDX) < 7 || sourceIDX == 0)
+        continue;
+      entry.source = line + sourceIDX;
+      entry.source.erase(entry.source.find_last_not_of("\r\n") + 1);
+      regions[offset] = entry;
+    }
+    fclose(f);
+  }
+
+  // Returns false if the file could not be written
+  bool save()
+  {
+    if(!dirty) return true;
+    FILE* f = fopen(manifestPath.c_str(), "w");
+    if(!f) {
+      printf(CONSOLE_RED "Failed to write %s\n" CONSOLE_RESET, manifestPath.c_str());
+      return false;
+    }
+    fprintf(f, MANIFEST_VERSION "\n");
+    for(auto& [offset, entry] : regions)
+      fprintf(f, "%lx,%lx,%lx,%lx,%lx,%lx,%lx,%s\n", offset, entry.size, entry.srcSize, entry.srcMtime,
+              entry.srcHash, entry.frameHash, entry.written, entry.source.c_str());
+    fclose(f);
+    dirty = false;
+    return true;
+  }
+
+  const manifestEntry* find(u64 offset)
+  {
+    load();
+    auto it = regions.find(offset);
+    return it != regions.end() ? &it->second : nullptr;
+  }
+
+  // Drops every recorded region that overlaps [offset, offset+size)
+  void erase(u64 offset, u64 size)
+  {
+    load();
+    auto it = regions.lower_bound(offset + std::max(size, (u64)1));
+    while(it != regions.begin()) {
+      --it;
+      if(it->first + it->second.size <= offset) break;
+      it = regions.erase(it);
+      dirty = true;
+    }
+  }
+
+  void set(u64 offset, const manifestEntry& entry)
+  {
+    erase(offset, entry.size);
+    regions[offset] = entry;
+    dirty = true;
+  }
+
+  // Drops what is in memory, for when installed.txt was deleted behind the manifest's back
+  void forget()
+  {
+    regions.clear();
+    loaded = false;
+    dirty = false;
+  }
+
+  void touch(u64 offset, u64 srcMtime)
+  {
+    auto it = regions.find(offset);
+    if(it == regions.end()) return;
+    it->second.srcMtime = srcMtime;
+    dirty = true;
+  }
+};
+
+u64 hashFile(const char* path) {
+  FILE* f = fopen(path, "rb");
+  if(!f) return 0;
+  xxhash64 state;
+  const size_t bufSize = 0x20000;
+  char* buf = new char[bufSize];
+  size_t size;
+  while((size = fread(buf, 1, bufSize, f)) > 0)
+    state.update(buf, size);
+  delete[] buf;
+  fclose(f);
+  return state.digest();
+}
@@ -0,0 +1,221 @@
+#pragma once
+#include <switch.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#include <map>
+#include <string>
+#include <vector>
+#include "installEstimate.h"
+#include "zstdFrame.h"
+#include "compressionStats.h"
+
+/*
+ * Where an install spends its time. Code that does one kind of work opens a phaseTimer for
+ * it, and a timer opened inside another pauses the outer one, so every phase only counts
+ * its own time and the phases add up to the time measured. Nothing is recorded outside
+ * timingStart() and timingFinish(), which keeps the indexer and dry runs out of it.
+ * Only the thread running the install may open timers.
+ */
+#define PHASE_SCAN 0
+#define PHASE_LOOKUP 1
+#define PHASE_READ 2
+#define PHASE_COMPRESS 3
+#define PHASE_BACKUP 4
+#define PHASE_WRITE 5
+#define PHASE_SYNC 6
+#define PHASE_RESTORE 7
+#define PHASE_VERIFY 8
+#define PHASE_COUNT 9
+
+#define TIMING_REPORTS_KEPT 10
+
+const char* phaseNames[PHASE_COUNT] = {"scan", "lookup", "read", "compress", "backup", "write", "sync", "restore", "verify"};
+
+struct phaseTotal {
+  double seconds;
+  u64 bytes;
+  u64 calls;
+};
+
+// One mod file written to data.arc
+struct fileTiming {
+  std::string path;
+  u64 offset;
+  u64 size;
+  double seconds;
+  double compressSeconds;
+  int attempts;
+  int level;  // level of the last attempt, 0 if it was not compressed
+};
+
+bool timingActive = false;
+std::chrono::steady_clock::time_point timingBegin;
+phaseTotal phaseTotals[PHASE_COUNT];
+std::vector<fileTiming> fileTimings;
+fileTiming* currentFile = nullptr;
+class phaseTimer;
+phaseTimer* openPhase = nullptr;  // innermost timer, cleared by timingStart()
+
+class phaseTimer {
+public:
+  u64 bytes = 0;
+
+  phaseTimer(int phase) : phase(phase) {
+    if(!timingActive) return;
+    parent = openPhase;
+    openPhase = this;
+    start = std::chrono::steady_clock::now();
+  }
+  ~phaseTimer() {
+    if(!timingActive || openPhase != this) return;
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    phaseTotal& total = phaseTotals[phase];
+    total.seconds += std::max(seconds - childSeconds, 0.0);
+    total.bytes += bytes;
+    total.calls++;
+    if(phase == PHASE_COMPRESS && currentFile != nullptr)
+      currentFile->compressSeconds += seconds - childSeconds;
+    openPhase = parent;
+    if(parent != nullptr) parent->childSeconds += seconds;
+  }
+  phaseTimer(const phaseTimer&) = delete;
+  phaseTimer& operator=(const phaseTimer&) = delete;
+
+private:
+  int phase;
+  phaseTimer* parent = nullptr;
+  double childSeconds = 0;
+  std::chrono::steady_clock::time_point start;
+};
+
+// Times one mod file from start to finish, nested phases included
+class fileTimer {
+public:
+  fileTimer(const std::string& path, u64 offset, u64 size) {
+    if(!timingActive) return;
+    fileTimings.push_back({path, offset, size, 0, 0, 0, 0});
+    currentFile = &fileTimings.back();
+    start = std::chrono::steady_clock::now();
+  }
+  ~fileTimer() {
+    if(!timingActive || currentFile == nullptr) return;
+    currentFile->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    currentFile = nullptr;
+  }
+  fileTimer(const fileTimer&) = delete;
+  fileTimer& operator=(const fileTimer&) = delete;
+
+private:
+  std::chrono::steady_clock::time_point start;
+};
+
+// frameAttemptHook for compressFrame(), also called by the streaming compressor
+void timeFrameAttempt(int level, uint64_t inSize, size_t outSize, uint64_t compSize, double seconds) {
+  if(!timingActive) return;
+  bool fits = !ZSTD_isError(outSize) && outSize <= compSize;
+  countFrameAttempt(level, inSize, ZSTD_isError(outSize) ? 0 : outSize, fits, seconds);
+  if(currentFile != nullptr) {
+    currentFile->attempts++;
+    currentFile->level = level;
+  }
+}
+
+// Called by the compressors once a file is done, frameSize is 0 if it did not fit
+void timeCompressedFile(u64 inSize, u64 frameSize, u64 compSize) {
+  if(timingActive)
+    countCompressedFile(inSize, frameSize, compSize);
+}
+
+void timingStart() {
+  timingActive = true;
+  timingBegin = std::chrono::steady_clock::now();
+  for(phaseTotal& total : phaseTotals)
+    total = {0, 0, 0};
+  clearCompressionStats(installCompression);
+  fileAttempts = 0;
+  fileTimings.clear();
+  currentFile = nullptr;
+  openPhase = nullptr;
+  frameAttemptHook = timeFrameAttempt;
+}
+
+// Deletes all but the newest TIMING_REPORTS_KEPT reports, the names sort by date
+void pruneTimingReports(const char* dir) {
+  std::vector<std::string> reports;
+  DIR* d = opendir(dir);
+  if(!d) return;
+  struct dirent* entry;
+  while((entry = readdir(d)) != NULL) {
+    if(strncmp(entry->d_name, "install-", 8) == 0)
+      reports.push_back(entry->d_name);
+  }
+  closedir(d);
+  std::sort(reports.begin(), reports.end());
+  for(size_t i = 0; i + TIMING_REPORTS_KEPT < reports.size(); i++)
+    remove((std::string(dir) + reports[i]).c_str());
+}
+
+bool writeTimingJSON(const char* path, const char* kind, const std::vector<std::string>& mods, double seconds) {
+  FILE* f = fopen(path, "w");
+  if(!f) return false;
+  double measured = 0;
+  for(const phaseTotal& total : phaseTotals)
+    measured += total.seconds;
+  fprintf(f, "{\n  \"kind\": \"%s\",\n  \"mods\": [", kind);
+  for(size_t i = 0; i < mods.size(); i++)
+    fprintf(f, "%s\"%s\"", i ? ", " : "", jsonEscape(mods[i]).c_str());
+  fprintf(f, "],\n  \"seconds\": %.3f,\n  \"unaccounted\": %.3f,\n  \"files\": %lu,\n", seconds,
+          std::max(seconds - measured, 0.0), fileTimings.size());
+  fprintf(f, "  \"phases\": {");
+  for(int i = 0; i < PHASE_COUNT; i++) {
+    const phaseTotal& total = phaseTotals[i];
+    fprintf(f, "%s\n    \"%s\": {\"seconds\": %.3f, \"bytes\": %lu, \"calls\": %lu, \"MiBps\": %.1f}", i ? "," : "",
+            phaseNames[i], total.seconds, total.bytes, total.calls,
+            total.seconds > 0 ? total.bytes / total.seconds / 0x100000 : 0);
+  }
+  fprintf(f, "\n  },\n  \"compression\": ");
+  writeCompressionJSON(f, installCompression);
+  fprintf(f, ",\n  \"entries\": [");
+  for(size_t i = 0; i < fileTimings.size(); i++) {
+    const fileTiming& file = fileTimings[i];
+    fprintf(f, "%s\n    {\"path\": \"%s\", \"offset\": %lu, \"size\": %lu, \"seconds\": %.3f, \"compressSeconds\": %.3f, "
+            "\"attempts\": %d, \"level\": %d}", i ? "," : "", jsonEscape(file.path).c_str(), file.offset, file.size,
+            file.seconds, file.compressSeconds, file.attempts, file.level);
+  }
+  fprintf(f, "\n  ]\n}\n");
+  fclose(f);
+  return true;
+}
+
+// Stops recording, prints where the time went and writes the report to reportsDir.
+// kind is "install", "uninstall" or "profile".
+void timingFinish(const char* reportsDir, const char* kind, const std::vector<std::string>& mods) {
+  if(!timingActive) return;
+  timingActive = false;
+  frameAttemptHook = nullptr;
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - timingBegin).count();
+
+  printf("Took %.1f s:", seconds);
+  for(int i = 0; i < PHASE_COUNT; i++) {
+    if(phaseTotals[i].seconds >= 0.05)
+      printf(" %s %.1f s", phaseNames[i], phaseTotals[i].seconds);
+  }
+  printf("\n");
+
+  mkdir(reportsDir, 0777);
+  char name[0x40];
+  std::time_t now = std::time(0);
+  strftime(name, sizeof(name), "install-%Y%m%d-%H%M%S.json", std::localtime(&now));
+  std::string path = std::string(reportsDir) + name;
+  if(writeTimingJSON(path.c_str(), kind, mods, seconds))
+    printf("Timing report written to %s\n", path.c_str());
+  else
+    printf(CONSOLE_RED "Failed to write %s\n" CONSOLE_RESET, path.c_str());
+  pruneTimingReports(reportsDir);
+  fileTimings.clear();
+}
@@ -0,0 +1,231 @@
+#pragma once
+#include <switch.h>
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <zstd.h>
+#include "xxhash64.h"
+#include "memoryBudget.h"
+#include "installWorker.h"
+#include "installTimings.h"
+
+/*
+ * Optional check after an install that every region written to data.arc reads back as
+ * written and, for compressed regions, decodes to the mod's contents.
+ * The main thread reads regions from the SD card in batches and worker threads
+ * decompress and hash them. Frames are decoded through a small buffer and hashed as they
+ * go, so a region never needs more memory than its own size. A region too large for what
+ * is left of the memory budget is read and checked on the main thread in chunks instead.
+ */
+#define VERIFY_THREADS 3
+#define VERIFY_BATCH_SIZE 0x2000000
+#define VERIFY_STACK_SIZE 0x10000
+
+#define VERIFY_OK 0
+#define VERIFY_READ_FAILED 1
+#define VERIFY_FRAME_MISMATCH 2
+#define VERIFY_DECODE_FAILED 3
+#define VERIFY_CONTENT_MISMATCH 4
+
+const char* verifyErrors[] = {"ok", "could not be read back", "does not match what was written",
+                              "does not decompress", "decompresses to different contents"};
+
+struct verifyRegion {
+  u64 offset;
+  u64 size;
+  u64 frameHash;    // XXH64 of the bytes written
+  bool compressed;
+  u64 contentSize;  // decompressed size, or the most it can be if contentHash is 0
+  u64 contentHash;  // XXH64 of the decompressed contents, 0 if unknown
+  u64 decodedSize;  // what the region decompressed to, for the throughput report
+  std::string source;
+  int result;
+  char* data;
+};
+
+bool verifyInstall = false;
+std::vector<verifyRegion> writtenRegions;
+
+void recordWritten(u64 offset, u64 size, u64 frameHash, bool compressed, u64 contentSize, u64 contentHash, const std::string& source) {
+  if(verifyInstall)
+    writtenRegions.push_back({offset, size, frameHash, compressed, contentSize, contentHash, 0, source, VERIFY_OK, nullptr});
+}
+
+struct verifyBatch {
+  verifyRegion* regions;
+  size_t count;
+  std::atomic<size_t> next;
+};
+
+// Decodes a region's frame piece by piece, hashing what comes out
+struct verifyDecoder {
+  ZSTD_DCtx* dctx;
+  budgetBuffer out;
+  xxhash64 hash;
+  u64 decoded = 0;
+  size_t remaining = 0;  // what ZSTD_decompressStream() last returned, 0 at the end of a frame
+  bool failed = false;
+
+  verifyDecoder(ZSTD_DCtx* ctx) : dctx(ctx), out(ZSTD_DStreamOutSize()) {
+    ZSTD_DCtx_reset(dctx, ZSTD_reset_session_only);
+  }
+
+  void update(const char* data, u64 size, u64 limit) {
+    ZSTD_inBuffer input = {data, size, 0};
+    bool flushed = false;
+    while(!failed && (input.pos < input.size || !flushed)) {
+      ZSTD_outBuffer output = {out.data, out.size, 0};
+      remaining = ZSTD_decompressStream(dctx, &output, &input);
+      decoded += output.pos;
+      failed = ZSTD_isError(remaining) || decoded > limit;
+      if(!failed) hash.update(out.data, output.pos);
+      flushed = output.pos < output.size;  // a full buffer may have more output waiting
+    }
+  }
+
+  int finish(const verifyRegion& region) {
+    if(failed || remaining != 0 || (region.contentHash != 0 && decoded != region.contentSize))
+      return VERIFY_DECODE_FAILED;
+    if(region.contentHash != 0 && hash.digest() != region.contentHash)
+      return VERIFY_CONTENT_MISMATCH;
+    return VERIFY_OK;
+  }
+};
+
+void verifyOne(verifyRegion& region, ZSTD_DCtx* dctx) {
+  if(xxhash64::hash(region.data, region.size) != region.frameHash) {
+    region.result = VERIFY_FRAME_MISMATCH;
+    return;
+  }
+  if(!region.compressed)
+    return;
+  verifyDecoder decoder(dctx);
+  decoder.update(region.data, region.size, region.contentSize);
+  region.result = decoder.finish(region);
+  region.decodedSize = decoder.decoded;
+}
+
+// Checks a region in chunks read from data.arc, for regions that do not fit in a batch
+void verifyStreamed(verifyRegion& region, FILE* arc, ZSTD_DCtx* dctx) {
+  budgetBuffer chunk(std::min(region.size, (u64)VERIFY_BATCH_SIZE));
+  verifyDecoder decoder(dctx);
+  xxhash64 frameHash;
+  fseek(arc, region.offset, SEEK_SET);
+  for(u64 done = 0; done < region.size; done += chunk.size) {
+    u64 size = std::min(chunk.size, region.size - done);
+    if(fread(chunk.data, sizeof(char), size, arc) != size) {
+      region.result = VERIFY_READ_FAILED;
+      return;
+    }
+    frameHash.update(chunk.data, size);
+    if(region.compressed)
+      decoder.update(chunk.data, size, region.contentSize);
+  }
+  if(frameHash.digest() != region.frameHash)
+    region.result = VERIFY_FRAME_MISMATCH;
+  else if(region.compressed) {
+    region.result = decoder.finish(region);
+    region.decodedSize = decoder.decoded;
+  }
+}
+
+void verifyWorker(void* arg) {
+  verifyBatch* batch = (verifyBatch*)arg;
+  ZSTD_DCtx* dctx = ZSTD_createDCtx();
+  for(size_t i = batch->next++; i < batch->count; i = batch->next++) {
+    if(batch->regions[i].result == VERIFY_OK)
+      verifyOne(batch->regions[i], dctx);
+  }
+  ZSTD_freeDCtx(dctx);
+}
+
+// Verifies and clears writtenRegions. Returns the number of regions that failed.
+size_t verifyWrittenRegions(FILE* arc) {
+  if(writtenRegions.empty())
+    return 0;
+  printf("Verifying %lu region(s)...\n", writtenRegions.size());
+  refreshConsole();
+  phaseTimer timer(PHASE_VERIFY);
+  fflush(arc);
+  auto start = std::chrono::steady_clock::now();
+  u64 readBytes = 0, decodedBytes = 0;
+  size_t failures = 0;
+  ZSTD_DCtx* streamDctx = ZSTD_createDCtx();
+
+  size_t first = 0;
+  while(first < writtenRegions.size() && !installCancelled()) {
+    reportProgress("Verifying", first, writtenRegions.size(), readBytes);
+    // read as many regions as fit in one batch, leaving room for the workers' decode buffers
+    size_t last = first;
+    u64 batchSize = 0;
+    u64 decodeBuffers = VERIFY_THREADS * ZSTD_DStreamOutSize();
+    u64 batchLimit = budgetChunk(VERIFY_BATCH_SIZE + decodeBuffers);
+    batchLimit = batchLimit > decodeBuffers ? batchLimit - decodeBuffers : 0;
+    while(last < writtenRegions.size() && batchSize + writtenRegions[last].size <= batchLimit) {
+      verifyRegion& region = writtenRegions[last];
+      region.data = budgetAlloc(region.size);
+      if(region.data == nullptr)
+        break;
+      last++;
+      fseek(arc, region.offset, SEEK_SET);
+      if(fread(region.data, sizeof(char), region.size, arc) != region.size)
+        region.result = VERIFY_READ_FAILED;
+      batchSize += region.size;
+    }
+    if(last == first) {
+      // too large for a batch, checked here through a chunk at a time
+      verifyStreamed(writtenRegions[last++], arc, streamDctx);
+      batchSize = writtenRegions[first].size;
+    }
+    readBytes += batchSize;
+    timer.bytes += batchSize;
+
+    verifyBatch batch;
+    batch.regions = &writtenRegions[first];
+    batch.count = writtenRegions[first].data != nullptr ? last - first : 0;
+    batch.next = 0;
+    Thread threads[VERIFY_THREADS];
+    int started = 0;
+    for(int i = 0; i < VERIFY_THREADS && batch.count > 0; i++) {
+      if(R_SUCCEEDED(threadCreate(&threads[started], verifyWorker, &batch, VERIFY_STACK_SIZE, 0x2C, i))) {
+        if(R_SUCCEEDED(threadStart(&threads[started]))) started++;
+        else threadClose(&threads[started]);
+      }
+    }
+    if(started == 0 && batch.count > 0)
+      verifyWorker(&batch);
+    for(int i = 0; i < started; i++) {
+      threadWaitForExit(&threads[i]);
+      threadClose(&threads[i]);
+    }
+
+    for(size_t i = first; i < last; i++) {
+      verifyRegion& region = writtenRegions[i];
+      budgetFree(region.data, region.size);
+      if(region.result != VERIFY_OK) {
+        printf(CONSOLE_RED "%s (0x%lx) %s\n" CONSOLE_RESET, region.source.c_str(), region.offset, verifyErrors[region.result]);
+        failures++;
+      }
+      else if(region.compressed)
+        decodedBytes += region.decodedSize;
+    }
+    first = last;
+  }
+  ZSTD_freeDCtx(streamDctx);
+
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  if(seconds <= 0) seconds = 1e-6;
+  if(first < writtenRegions.size())
+    printf(CONSOLE_YELLOW "Cancelled, %lu of %lu region(s) were not verified\n" CONSOLE_RESET,
+           writtenRegions.size() - first, writtenRegions.size());
+  if(failures == 0 && first == writtenRegions.size())
+    printf(CONSOLE_GREEN "All %lu region(s) verified\n" CONSOLE_RESET, writtenRegions.size());
+  else if(failures > 0)
+    printf(CONSOLE_RED "%lu of %lu region(s) failed verification\n" CONSOLE_RESET, failures, writtenRegions.size());
+  printf("Verified %lu KiB (%lu KiB decompressed) in %.1f s, %.1f MiB/s\n\n", readBytes / 1024, decodedBytes / 1024,
+         seconds, readBytes / seconds / 1048576.0);
+  writtenRegions.clear();
+  return failures;
+}
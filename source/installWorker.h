@@ -0,0 +1,207 @@
+#pragma once
+#include <switch.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/iosupport.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+extern "C" {
+#include "console.h"
+}
+
+/*
+ * Runs installs on a worker thread while the menu thread keeps drawing. The worker hands
+ * its output and progress to the menu thread through a single producer, single consumer
+ * ring, and its printf()s are routed there by a hook on stdout, so the install code prints
+ * as it always has. Only the menu thread touches the console.
+ */
+#define WORKER_STACK_SIZE 0x100000
+#define WORKER_QUEUE_SIZE 256
+#define WORKER_LOG_CHUNK 120
+#define WORKER_STATUS_INTERVAL 0.1
+
+#define EVENT_LOG 0
+#define EVENT_PROGRESS 1
+
+struct workerEvent {
+  u8 kind;
+  u16 len;                // bytes of text for EVENT_LOG
+  const char* phase;      // "Installing", "Restoring", ... for EVENT_PROGRESS
+  u64 done;
+  u64 total;
+  u64 bytes;              // bytes written to data.arc so far
+  char text[WORKER_LOG_CHUNK];
+};
+
+workerEvent workerQueue[WORKER_QUEUE_SIZE];
+std::atomic<u32> workerQueueHead(0);  // written by the worker
+std::atomic<u32> workerQueueTail(0);  // written by the menu thread
+
+Thread workerThread;
+bool workerRunning = false;
+std::atomic<bool> workerFinished(false);
+std::atomic<bool> workerCancel(false);
+const devoptab_t* consoleDevoptab = nullptr;
+devoptab_t workerDevoptab;
+
+bool pushWorkerEvent(const workerEvent& event) {
+  u32 head = workerQueueHead.load(std::memory_order_relaxed);
+  if(head - workerQueueTail.load(std::memory_order_acquire) == WORKER_QUEUE_SIZE)
+    return false;
+  workerQueue[head % WORKER_QUEUE_SIZE] = event;
+  workerQueueHead.store(head + 1, std::memory_order_release);
+  return true;
+}
+
+bool popWorkerEvent(workerEvent& event) {
+  u32 tail = workerQueueTail.load(std::memory_order_relaxed);
+  if(tail == workerQueueHead.load(std::memory_order_acquire))
+    return false;
+  event = workerQueue[tail % WORKER_QUEUE_SIZE];
+  workerQueueTail.store(tail + 1, std::memory_order_release);
+  return true;
+}
+
+bool onWorkerThread() {
+  return workerRunning && threadGetCurHandle() == workerThread.handle;
+}
+
+// Log text is never dropped, the worker waits for the menu thread to make room
+ssize_t workerWrite(struct _reent* r, void* fd, const char* ptr, size_t len) {
+  if(!onWorkerThread())
+    return consoleDevoptab->write_r(r, fd, ptr, len);
+  workerEvent event;
+  event.kind = EVENT_LOG;
+  for(size_t done = 0; done < len;) {
+    event.len = std::min(len - done, (size_t)WORKER_LOG_CHUNK);
+    memcpy(event.text, ptr + done, event.len);
+    while(!pushWorkerEvent(event))
+      svcSleepThread(1000000);
+    done += event.len;
+  }
+  return len;
+}
+
+// consoleUpdate() for code that may run on the worker, where the menu thread draws instead
+void refreshConsole() {
+  if(!onWorkerThread())
+    consoleUpdate(NULL);
+}
+
+// Progress is only reported from the worker, and dropped if the menu thread is behind.
+// stdout keeps its buffering, so a line still being printed is flushed here to keep it
+// ahead of the progress and on screen while a long region is written.
+void reportProgress(const char* phase, u64 done, u64 total, u64 bytes) {
+  if(!onWorkerThread())
+    return;
+  fflush(stdout);
+  workerEvent event;
+  event.kind = EVENT_PROGRESS;
+  event.len = 0;
+  event.phase = phase;
+  event.done = done;
+  event.total = total;
+  event.bytes = bytes;
+  pushWorkerEvent(event);
+}
+
+// Checked by the install code between regions
+bool installCancelled() {
+  return workerCancel;
+}
+
+void workerEntry(void* arg) {
+  ((void (*)())arg)();
+  fflush(stdout);
+  workerFinished = true;
+}
+
+bool startWorker(void (*job)()) {
+  workerQueueHead = 0;
+  workerQueueTail = 0;
+  workerFinished = false;
+  workerCancel = false;
+  if(R_FAILED(threadCreate(&workerThread, workerEntry, (void*)job, WORKER_STACK_SIZE, 0x2C, 1)))
+    return false;
+  consoleDevoptab = devoptab_list[STD_OUT];
+  workerDevoptab = *consoleDevoptab;
+  workerDevoptab.write_r = workerWrite;
+  devoptab_list[STD_OUT] = &workerDevoptab;
+  workerRunning = true;
+  if(R_FAILED(threadStart(&workerThread))) {
+    workerRunning = false;
+    devoptab_list[STD_OUT] = consoleDevoptab;
+    threadClose(&workerThread);
+    return false;
+  }
+  return true;
+}
+
+// Progress as last reported, kept by the menu thread
+struct workerStatus {
+  const char* phase = nullptr;
+  u64 done = 0;
+  u64 total = 0;
+  u64 bytes = 0;
+  std::chrono::steady_clock::time_point start;
+  std::chrono::steady_clock::time_point lastDrawn;
+};
+workerStatus workerProgress;
+
+void drawWorkerStatus() {
+  const workerStatus& s = workerProgress;
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - s.start).count();
+  if(s.phase == nullptr || s.total == 0 || seconds <= 0) {
+    console_set_status("\n" GREEN "Mod Installer" RESET "%s", workerCancel ? "  cancelling..." : "  working...  B=cancel");
+    return;
+  }
+  double rate = s.bytes / seconds / 1048576.0;
+  if(s.done == 0 || s.done >= s.total) {
+    console_set_status("\n" GREEN "Mod Installer" RESET "  %s %lu/%lu  %.1f MiB/s%s", s.phase, s.done, s.total, rate,
+                       workerCancel ? "  cancelling..." : "  B=cancel");
+    return;
+  }
+  u64 eta = seconds * (s.total - s.done) / s.done;
+  console_set_status("\n" GREEN "Mod Installer" RESET "  %s %lu/%lu  %.1f MiB/s  ETA %lu:%02lu%s", s.phase, s.done, s.total,
+                     rate, eta / 60, eta % 60, workerCancel ? "  cancelling..." : "  B=cancel");
+}
+
+// Called every frame while the worker runs. Prints its output, redraws the status bar at a
+// fixed rate and cancels on B. Returns true once the worker has exited.
+bool updateWorker(u64 kDown) {
+  if(!workerRunning)
+    return true;
+  if(kDown & KEY_B && !workerCancel) {
+    workerCancel = true;
+    drawWorkerStatus();
+  }
+  bool finished = workerFinished;  // read first, so everything it printed is already queued
+  workerEvent event;
+  while(popWorkerEvent(event)) {
+    if(event.kind == EVENT_LOG)
+      fwrite(event.text, 1, event.len, stdout);
+    else {
+      if(event.phase != workerProgress.phase)
+        workerProgress.start = std::chrono::steady_clock::now();
+      workerProgress.phase = event.phase;
+      workerProgress.done = event.done;
+      workerProgress.total = event.total;
+      workerProgress.bytes = event.bytes;
+    }
+  }
+  auto now = std::chrono::steady_clock::now();
+  if(std::chrono::duration<double>(now - workerProgress.lastDrawn).count() >= WORKER_STATUS_INTERVAL) {
+    drawWorkerStatus();
+    workerProgress.lastDrawn = now;
+  }
+  if(!finished)
+    return false;
+  threadWaitForExit(&workerThread);
+  threadClose(&workerThread);
+  workerRunning = false;
+  devoptab_list[STD_OUT] = consoleDevoptab;
+  workerProgress = workerStatus();
+  console_set_status("\n" GREEN "Mod Installer" RESET);
+  return true;
+}
@@ -15,6 +15,7 @@ extern "C" {
 void mainMenuLoop(int kDown) {
     if (kDown & KEY_Y) {
         installation_finish = false;
+        modFoldersStale = true;
         menu = MOD_INSTALLER_MENU;
 
         consoleClear();
@@ -22,6 +23,11 @@ void mainMenuLoop(int kDown) {
 
         if (installation_finish)
             printf("Mod Installer already finished. Press B to return to the main menu.\n\n");
+
+        if (recoverInterruptedInstall()) {
+            installation_finish = true;
+            printf("Press B to continue to the Mod Installer.\n");
+        }
     }
 
     else if (kDown & KEY_X) {
@@ -52,19 +58,24 @@ int main(int argc, char **argv)
 
         u64 kDown = hidKeysDown(CONTROLLER_P1_AUTO);
 
-        if (kDown & KEY_PLUS) break; // break in order to return to hbmenu
+        if (kDown & KEY_PLUS && !workerRunning && !searchTyping) break; // break in order to return to hbmenu
 
         if (menu == MAIN_MENU)
             mainMenuLoop(kDown);
         else if (menu == MOD_INSTALLER_MENU)
             modInstallerMainLoop(kDown);
-        else if (menu == ARC_DUMPER_MENU)
+        else if (menu == ARC_DUMPER_MENU) {
+            bool dumped = dump_done;
             dumperMainLoop(kDown);
+            if (dump_done && !dumped)
+                manifest.forget();
+        }
         else if (menu == FTP_MENU)
             ftp_main();
 
         consoleUpdate(NULL);
     }
+    stopIndexer();
     consoleExit(NULL);
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,92 @@
+#pragma once
+#include <switch.h>
+#include <stdio.h>
+#include <algorithm>
+#include <atomic>
+#include <new>
+
+/*
+ * Ceiling for the installer's large buffers, set with memory_budget_mb in config.txt
+ * (0 means no limit). Buffers that hold a whole file or region are taken with
+ * budgetAlloc(), and callers stream through a budgetBuffer when a file does not fit.
+ * Nothing is allocated past the budget: once it is used up, streaming goes on through
+ * BUDGET_MIN_CHUNK bytes on the stack. zstd contexts and such small fixed buffers are
+ * not counted.
+ */
+#define BUDGET_CHUNK_SIZE 0x100000
+#define BUDGET_MIN_CHUNK 0x1000
+
+u64 memoryBudget = 0;
+std::atomic<u64> memoryInUse(0);
+std::atomic<u64> memoryPeak(0);
+
+bool budgetFits(u64 size) {
+  return memoryBudget == 0 || memoryInUse + size <= memoryBudget;
+}
+
+// Returns nullptr rather than going over the budget
+char* budgetAlloc(u64 size) {
+  // reserved before allocating, so threads allocating at once can not pass the budget together
+  u64 inUse = memoryInUse;
+  do {
+    if(memoryBudget != 0 && inUse + size > memoryBudget)
+      return nullptr;
+  } while(!memoryInUse.compare_exchange_weak(inUse, inUse + size));
+  inUse += size;
+  char* buf = new (std::nothrow) char[size];
+  if(buf == nullptr) {
+    memoryInUse -= size;
+    return nullptr;
+  }
+  u64 peak = memoryPeak;
+  while(inUse > peak && !memoryPeak.compare_exchange_weak(peak, inUse));
+  return buf;
+}
+
+void budgetFree(char* buf, u64 size) {
+  if(buf == nullptr)
+    return;
+  delete[] buf;
+  memoryInUse -= size;
+}
+
+// The largest buffer of up to size bytes the budget has room for, may be 0
+u64 budgetChunk(u64 size) {
+  if(memoryBudget == 0)
+    return size;
+  u64 available = memoryBudget > memoryInUse ? memoryBudget - memoryInUse : 0;
+  return std::min(size, available);
+}
+
+// A streaming buffer of up to size bytes, taken from the budget while it lasts and
+// BUDGET_MIN_CHUNK bytes on the stack after that. Freed when it goes out of scope.
+struct budgetBuffer {
+  char* data;
+  u64 size;
+  bool counted;
+  char fallback[BUDGET_MIN_CHUNK];
+
+  budgetBuffer(u64 want) {
+    size = std::max(budgetChunk(want), std::min(want, (u64)BUDGET_MIN_CHUNK));
+    data = size > BUDGET_MIN_CHUNK ? budgetAlloc(size) : nullptr;
+    counted = data != nullptr;
+    if(!counted) {
+      size = std::max(std::min(size, (u64)BUDGET_MIN_CHUNK), (u64)1);
+      data = fallback;
+    }
+  }
+  ~budgetBuffer() {
+    if(counted) budgetFree(data, size);
+  }
+  budgetBuffer(const budgetBuffer&) = delete;
+  budgetBuffer& operator=(const budgetBuffer&) = delete;
+};
+
+// Prints and resets the peak of the last install
+void printMemoryPeak() {
+  if(memoryBudget != 0)
+    printf("Peak installer memory: %lu KiB of %lu KiB budget\n", (u64)memoryPeak / 1024, memoryBudget / 1024);
+  else
+    printf("Peak installer memory: %lu KiB\n", (u64)memoryPeak / 1024);
+  memoryPeak = (u64)memoryInUse;
+}
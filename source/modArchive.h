@@ -0,0 +1,215 @@
+#pragma once
+#include <switch.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <zlib.h>
+
+/*
+ * Read-only access to mods packed as .zip or .tar, so their files can be installed
+ * straight from the archive instead of being extracted to the SD card first.
+ * Zip entries can be stored or deflated. Zip64 and encrypted zips are not supported.
+ */
+#define ARCHIVE_ZIP 0
+#define ARCHIVE_TAR 1
+#define ARCHIVE_READ_SIZE 0x20000
+
+struct archiveEntry {
+  std::string name;  // path inside the archive
+  u64 offset;        // zip: local header offset, tar: data offset
+  u64 compSize;
+  u64 size;
+  u16 method;        // zip compression method, 0 for tar
+};
+
+bool isModArchive(const std::string& name) {
+  if(name.size() < 5) return false;
+  std::string ext = name.substr(name.size() - 4);
+  for(char& c : ext) c = tolower(c);
+  return ext == ".zip" || ext == ".tar";
+}
+
+u16 readLE16(const unsigned char* p) { return p[0] | (p[1] << 8); }
+u32 readLE32(const unsigned char* p) { return readLE16(p) | ((u32)readLE16(p + 2) << 16); }
+
+class modArchive {
+public:
+  std::string path;
+  int type;
+  u64 mtime = 0;
+  std::vector<archiveEntry> entries;
+
+  modArchive(const std::string& archivePath) : path(archivePath) {
+    std::string ext = path.substr(path.size() - 4);
+    for(char& c : ext) c = tolower(c);
+    type = ext == ".zip" ? ARCHIVE_ZIP : ARCHIVE_TAR;
+    struct stat st;
+    if(stat(path.c_str(), &st) == 0) mtime = st.st_mtime;
+    f = fopen(path.c_str(), "rb");
+    if(f == nullptr) return;
+    bool ok = type == ARCHIVE_ZIP ? readZipIndex() : readTarIndex();
+    if(!ok) {
+      printf(CONSOLE_RED "Could not read archive %s\n" CONSOLE_RESET, path.c_str());
+      entries.clear();
+    }
+  }
+
+  ~modArchive() {
+    if(f != nullptr) fclose(f);
+  }
+
+  // out must hold entry.size bytes
+  bool read(const archiveEntry& entry, char* out) {
+    if(f == nullptr) return false;
+    u64 dataOffset = entry.offset;
+    if(type == ARCHIVE_ZIP) {
+      unsigned char local[30];
+      fseek(f, entry.offset, SEEK_SET);
+      if(fread(local, 1, sizeof(local), f) != sizeof(local) || readLE32(local) != 0x04034b50)
+        return false;
+      dataOffset += sizeof(local) + readLE16(local + 26) + readLE16(local + 28);
+    }
+    fseek(f, dataOffset, SEEK_SET);
+    if(entry.method == 0)
+      return entry.compSize == entry.size && fread(out, sizeof(char), entry.size, f) == entry.size;
+    return inflateEntry(entry, out);
+  }
+
+private:
+  FILE* f = nullptr;
+
+  bool inflateEntry(const archiveEntry& entry, char* out) {
+    z_stream strm;
+    memset(&strm, 0, sizeof(strm));
+    if(inflateInit2(&strm, -MAX_WBITS) != Z_OK) return false;
+    char* inBuf = new char[ARCHIVE_READ_SIZE];
+    strm.next_out = (Bytef*)out;
+    strm.avail_out = entry.size;
+    u64 remaining = entry.compSize;
+    int ret = Z_OK;
+    while(ret == Z_OK && remaining > 0) {
+      size_t size = fread(inBuf, 1, std::min((u64)ARCHIVE_READ_SIZE, remaining), f);
+      if(size == 0) break;
+      remaining -= size;
+      strm.next_in = (Bytef*)inBuf;
+      strm.avail_in = size;
+      ret = inflate(&strm, Z_NO_FLUSH);
+    }
+    bool ok = ret == Z_STREAM_END && strm.total_out == entry.size;
+    inflateEnd(&strm);
+    delete[] inBuf;
+    return ok;
+  }
+
+  bool readZipIndex() {
+    fseek(f, 0, SEEK_END);
+    u64 fileSize = ftell(f);
+    // the end of central directory record is followed by a comment of up to 0xFFFF bytes
+    u64 tailSize = std::min(fileSize, (u64)0xFFFF + 22);
+    std::vector<unsigned char> tail(tailSize);
+    fseek(f, fileSize - tailSize, SEEK_SET);
+    if(fread(tail.data(), 1, tailSize, f) != tailSize) return false;
+    s64 eocd = tailSize - 22;
+    while(eocd >= 0 && readLE32(&tail[eocd]) != 0x06054b50) eocd--;
+    if(eocd < 0) return false;
+    u16 numEntries = readLE16(&tail[eocd + 10]);
+    u32 dirSize = readLE32(&tail[eocd + 12]);
+    u32 dirOffset = readLE32(&tail[eocd + 16]);
+    if(numEntries == 0xFFFF || dirOffset == 0xFFFFFFFF) {
+      printf(CONSOLE_RED "Zip64 archives are not supported\n" CONSOLE_RESET);
+      return false;
+    }
+
+    std::vector<unsigned char> dir(dirSize);
+    fseek(f, dirOffset, SEEK_SET);
+    if(fread(dir.data(), 1, dirSize, f) != dirSize) return false;
+    size_t pos = 0;
+    for(u16 i = 0; i < numEntries; i++) {
+      if(pos + 46 > dirSize || readLE32(&dir[pos]) != 0x02014b50) return false;
+      const unsigned char* h = &dir[pos];
+      archiveEntry entry;
+      u16 flags = readLE16(h + 8);
+      entry.method = readLE16(h + 10);
+      entry.compSize = readLE32(h + 20);
+      entry.size = readLE32(h + 24);
+      u16 nameLen = readLE16(h + 28);
+      u16 extraLen = readLE16(h + 30);
+      u16 commentLen = readLE16(h + 32);
+      entry.offset = readLE32(h + 42);
+      if(pos + 46 + nameLen > dirSize) return false;
+      entry.name.assign((const char*)h + 46, nameLen);
+      pos += 46 + nameLen + extraLen + commentLen;
+      if(entry.name.empty() || entry.name.back() == '/')
+        continue;
+      if((flags & 1) || (entry.method != 0 && entry.method != Z_DEFLATED)) {
+        printf(CONSOLE_RED "%s: encrypted or unsupported compression\n" CONSOLE_RESET, entry.name.c_str());
+        continue;
+      }
+      addEntry(entry);
+    }
+    return true;
+  }
+
+  bool readTarIndex() {
+    unsigned char header[512];
+    u64 pos = 0;
+    std::string longName;
+    fseek(f, 0, SEEK_SET);
+    while(fread(header, 1, sizeof(header), f) == sizeof(header)) {
+      pos += sizeof(header);
+      if(header[0] == 0) break;  // end of archive
+      char sizeField[13] = {0};
+      memcpy(sizeField, header + 124, 12);
+      u64 size = strtoull(sizeField, nullptr, 8);
+      char typeflag = header[156];
+      u64 dataBlocks = (size + 511) / 512 * 512;
+
+      if(typeflag == 'L' || typeflag == 'x') {
+        // GNU long name or pax header, both name the following entry
+        std::vector<char> data(size);
+        if(fread(data.data(), 1, size, f) != size) return false;
+        if(typeflag == 'L')
+          longName.assign(data.data(), strnlen(data.data(), size));
+        else {
+          std::string records(data.data(), size);
+          size_t key = records.find(" path=");
+          if(key != std::string::npos) {
+            size_t end = records.find('\n', key);
+            longName = records.substr(key + 6, end - key - 6);
+          }
+        }
+      }
+      else if(typeflag == '0' || typeflag == '\0' || typeflag == '7') {
+        archiveEntry entry;
+        if(!longName.empty())
+          entry.name = longName;
+        else {
+          std::string prefix((const char*)header + 345, strnlen((const char*)header + 345, 155));
+          entry.name.assign((const char*)header, strnlen((const char*)header, 100));
+          if(!prefix.empty() && memcmp(header + 257, "ustar", 5) == 0)
+            entry.name = prefix + "/" + entry.name;
+        }
+        longName.clear();
+        entry.offset = pos;
+        entry.compSize = entry.size = size;
+        entry.method = 0;
+        addEntry(entry);
+      }
+      else longName.clear();
+      pos += dataBlocks;
+      fseek(f, pos, SEEK_SET);
+    }
+    return true;
+  }
+
+  void addEntry(archiveEntry& entry) {
+    if(entry.name.compare(0, 2, "./") == 0)
+      entry.name.erase(0, 2);
+    if(!entry.name.empty())
+      entries.push_back(entry);
+  }
+};
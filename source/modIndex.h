@@ -0,0 +1,117 @@
+#pragma once
+#include <switch.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#define MOD_INDEX_VERSION "UMM mod index v2"
+
+// What the menu knows about a mod folder before it is installed
+struct modInfo {
+  u64 stamp;          // newest folder mtime in the mod, or the file's mtime for packed mods
+  u64 files;          // files found, resolved or not
+  u64 targets;        // files that resolve to a data.arc region
+  u64 size;           // total size of the resolved files
+  u64 compressFiles;  // files that have to be compressed on the console
+  u64 failures;       // files predicted not to install
+  double seconds;     // estimated install time on a vanilla data.arc
+  u64 installed;      // regions currently written from this mod, from the manifest and not saved
+  std::string tags;   // space separated fighters and stages the mod replaces files of
+};
+
+// Mod summaries built by the background indexer, shared with the menu.
+// Every access takes the lock, the indexer runs on its own thread.
+class modIndex
+{
+private:
+  std::string indexPath;
+  bool loaded = false;
+  bool dirty = false;
+  Mutex lock;
+  std::map<std::string, modInfo> mods;
+public:
+  modIndex(std::string path) : indexPath(path) { mutexInit(&lock); }
+
+  void load()
+  {
+    mutexLock(&lock);
+    if(!loaded) {
+      loaded = true;
+      FILE* f = fopen(indexPath.c_str(), "r");
+      if(f) {
+        char line[0x1000];
+        // older versions are rebuilt from scratch
+        bool current = fgets(line, sizeof(line), f) && strncmp(line, MOD_INDEX_VERSION "\n", sizeof(MOD_INDEX_VERSION)) == 0;
+        while(current && fgets(line, sizeof(line), f)) {
+          modInfo info = {};
+          int tagsIDX = 0;
+          if(sscanf(line, "%lx,%lx,%lx,%lx,%lx,%lx,%lf,%n", &info.stamp, &info.files, &info.targets, &info.size,
+                    &info.compressFiles, &info.failures, &info.seconds, &tagsIDX) < 7 || tagsIDX == 0)
+            continue;
+          const char* comma = strchr(line + tagsIDX, ',');
+          if(comma == nullptr)
+            continue;
+          info.tags.assign(line + tagsIDX, comma - (line + tagsIDX));
+          std::string name = comma + 1;
+          name.erase(name.find_last_not_of("\r\n") + 1);
+          mods[name] = info;
+        }
+        fclose(f);
+      }
+    }
+    mutexUnlock(&lock);
+  }
+
+  void save()
+  {
+    mutexLock(&lock);
+    if(dirty) {
+      FILE* f = fopen(indexPath.c_str(), "w");
+      if(f) {
+        fprintf(f, MOD_INDEX_VERSION "\n");
+        for(auto& [name, info] : mods)
+          fprintf(f, "%lx,%lx,%lx,%lx,%lx,%lx,%.3f,%s,%s\n", info.stamp, info.files, info.targets, info.size,
+                  info.compressFiles, info.failures, info.seconds, info.tags.c_str(), name.c_str());
+        fclose(f);
+        dirty = false;
+      }
+    }
+    mutexUnlock(&lock);
+  }
+
+  bool get(const std::string& name, modInfo& info)
+  {
+    mutexLock(&lock);
+    auto it = mods.find(name);
+    bool found = it != mods.end();
+    if(found) info = it->second;
+    mutexUnlock(&lock);
+    return found;
+  }
+
+  void set(const std::string& name, const modInfo& info)
+  {
+    mutexLock(&lock);
+    modInfo& entry = mods[name];
+    dirty |= entry.stamp != info.stamp || entry.files != info.files || entry.seconds != info.seconds;
+    entry = info;
+    mutexUnlock(&lock);
+  }
+
+  // Drops mods that are no longer in the mods folder
+  void keepOnly(const std::vector<std::string>& names)
+  {
+    mutexLock(&lock);
+    for(auto it = mods.begin(); it != mods.end();) {
+      if(std::find(names.begin(), names.end(), it->first) == names.end()) {
+        it = mods.erase(it);
+        dirty = true;
+      }
+      else it++;
+    }
+    mutexUnlock(&lock);
+  }
+};
@@ -0,0 +1,210 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <zstd.h>
+
+/*
+ * Binary patch against a vanilla arc file, installed in place of the whole modified file.
+ * Named <arc path>.ummpatch inside a mod folder.
+ *   patchHeader
+ *   zstd frame, decompressing to bodySize bytes of bsdiff style control blocks:
+ *     u64 addLen, u64 extraLen, s64 seek
+ *     addLen bytes added to the old file, extraLen bytes copied as is
+ *     then the old file position moves by seek
+ */
+#define PATCH_EXT ".ummpatch"
+
+const char patchMagic[8] = {'U','M','M','P','A','T','C','H'};
+
+struct patchHeader {
+  char magic[8];
+  uint64_t newSize;
+  uint64_t oldSize;
+  uint64_t bodySize;
+};
+
+bool isPatchFile(const std::string& path) {
+  size_t extLen = strlen(PATCH_EXT);
+  return path.size() > extLen && path.compare(path.size() - extLen, extLen, PATCH_EXT) == 0;
+}
+
+// The arc path a patch applies to
+std::string patchTarget(const std::string& path) {
+  return isPatchFile(path) ? path.substr(0, path.size() - strlen(PATCH_EXT)) : path;
+}
+
+// Applies a patch file's contents to oldData. Returns false if the patch is malformed, was
+// made for a different version of the file or makes a file larger than maxNewSize.
+bool applyPatch(const char* oldData, uint64_t oldSize, const char* patch, uint64_t patchSize, uint64_t maxNewSize,
+                std::vector<char>& out) {
+  patchHeader header;
+  if(patchSize < sizeof(header)) return false;
+  memcpy(&header, patch, sizeof(header));
+  if(memcmp(header.magic, patchMagic, sizeof(patchMagic)) != 0 || header.oldSize != oldSize)
+    return false;
+  // checked before allocating, control blocks may not outweigh the bytes they make
+  if(header.newSize > maxNewSize || header.bodySize > 2 * header.newSize + 24 ||
+     ZSTD_getFrameContentSize(patch + sizeof(header), patchSize - sizeof(header)) != header.bodySize)
+    return false;
+  std::vector<char> body(header.bodySize);
+  size_t bodySize = ZSTD_decompress(body.data(), body.size(), patch + sizeof(header), patchSize - sizeof(header));
+  if(ZSTD_isError(bodySize) || bodySize != header.bodySize)
+    return false;
+
+  out.assign(header.newSize, 0);
+  uint64_t newPos = 0;
+  int64_t oldPos = 0;
+  size_t pos = 0;
+  while(pos < bodySize) {
+    uint64_t addLen, extraLen;
+    int64_t seek;
+    if(bodySize - pos < 24) return false;
+    memcpy(&addLen, &body[pos], 8);
+    memcpy(&extraLen, &body[pos+8], 8);
+    memcpy(&seek, &body[pos+16], 8);
+    pos += 24;
+    if(addLen > bodySize - pos || extraLen > bodySize - pos - addLen ||
+       addLen > header.newSize - newPos || extraLen > header.newSize - newPos - addLen)
+      return false;
+    for(uint64_t i = 0; i < addLen; i++) {
+      char oldByte = (oldPos + (int64_t)i >= 0 && oldPos + i < oldSize) ? oldData[oldPos + i] : 0;
+      out[newPos + i] = oldByte + body[pos + i];
+    }
+    pos += addLen;
+    newPos += addLen;
+    oldPos += addLen;
+    memcpy(&out[newPos], &body[pos], extraLen);
+    pos += extraLen;
+    newPos += extraLen;
+    oldPos += seek;
+  }
+  return newPos == header.newSize;
+}
+
+#define PATCH_WINDOW 16     // bytes hashed to find a match, old data is indexed every PATCH_WINDOW bytes
+#define PATCH_MIN_MATCH 32  // shorter matches are stored as extra bytes
+
+// A run of newData diffed against oldData, see makePatch()
+struct patchMatch {
+  uint64_t newStart;
+  uint64_t oldStart;
+  uint64_t len;
+};
+
+uint64_t patchWindowHash(const char* p) {
+  uint64_t a, b;
+  memcpy(&a, p, 8);
+  memcpy(&b, p + 8, 8);
+  uint64_t h = (a ^ (b << 31 | b >> 33)) * 0x9E3779B97F4A7C15ULL;
+  return h ^ (h >> 29);
+}
+
+// Finds where blocks of newData came from in oldData, bsdiff style: exact matches are found
+// through a hash of every aligned PATCH_WINDOW bytes of oldData, grown in both directions,
+// then extended forward while the bytes after them still mostly agree, so small edits inside
+// a block stay part of it.
+std::vector<patchMatch> findPatchMatches(const char* oldData, uint64_t oldSize, const char* newData, uint64_t newSize) {
+  std::vector<patchMatch> matches;
+  if(oldSize < PATCH_WINDOW || newSize < PATCH_WINDOW)
+    return matches;
+  uint64_t tableSize = 1;
+  while(tableSize < 2 * (oldSize / PATCH_WINDOW)) tableSize <<= 1;
+  std::vector<int64_t> table(tableSize, -1);
+  for(uint64_t pos = 0; pos + PATCH_WINDOW <= oldSize; pos += PATCH_WINDOW)
+    table[patchWindowHash(oldData + pos) & (tableSize - 1)] = pos;
+
+  uint64_t scan = 0;
+  while(scan + PATCH_WINDOW <= newSize) {
+    uint64_t lowerNew = matches.empty() ? 0 : matches.back().newStart + matches.back().len;
+    int64_t candidates[2] = {-1, table[patchWindowHash(newData + scan) & (tableSize - 1)]};
+    if(!matches.empty() && matches.back().oldStart + (scan - matches.back().newStart) + PATCH_WINDOW <= oldSize)
+      candidates[0] = matches.back().oldStart + (scan - matches.back().newStart);  // same shift as the last match
+    bool found = false;
+    for(int64_t candidate : candidates) {
+      if(candidate < 0 || memcmp(oldData + candidate, newData + scan, PATCH_WINDOW) != 0)
+        continue;
+      uint64_t oldPos = candidate;
+      uint64_t back = 0, forward = PATCH_WINDOW;
+      while(scan - back > lowerNew && oldPos > back && oldData[oldPos - back - 1] == newData[scan - back - 1])
+        back++;
+      while(scan + forward < newSize && oldPos + forward < oldSize && oldData[oldPos + forward] == newData[scan + forward])
+        forward++;
+      if(back + forward < PATCH_MIN_MATCH)
+        continue;
+      matches.push_back({scan - back, oldPos - back, back + forward});
+      scan += forward;
+      found = true;
+      break;
+    }
+    if(!found) scan++;
+  }
+
+  for(size_t i = 0; i < matches.size(); i++) {
+    patchMatch& match = matches[i];
+    uint64_t newEnd = match.newStart + match.len;
+    uint64_t oldEnd = match.oldStart + match.len;
+    uint64_t gapEnd = i + 1 < matches.size() ? matches[i + 1].newStart : newSize;
+    int64_t same = 0, bestScore = 0;
+    uint64_t extend = 0;
+    for(uint64_t k = 0; newEnd + k < gapEnd && oldEnd + k < oldSize; k++) {
+      if(oldData[oldEnd + k] == newData[newEnd + k]) same++;
+      if(2 * same - (int64_t)(k + 1) > bestScore) {
+        bestScore = 2 * same - (int64_t)(k + 1);
+        extend = k + 1;
+      }
+    }
+    match.len += extend;
+  }
+  return matches;
+}
+
+void appendControl(std::vector<char>& body, uint64_t addLen, uint64_t extraLen, int64_t seek) {
+  size_t pos = body.size();
+  body.resize(pos + 24);
+  memcpy(&body[pos], &addLen, 8);
+  memcpy(&body[pos+8], &extraLen, 8);
+  memcpy(&body[pos+16], &seek, 8);
+}
+
+// Makes a patch from oldData to newData. Moved and shifted blocks are found with
+// findPatchMatches() and diffed against where they came from, bytes outside any match are
+// stored as is. Files with no match at all are diffed in place.
+std::vector<char> makePatch(const char* oldData, uint64_t oldSize, const char* newData, uint64_t newSize, int level = 19) {
+  std::vector<patchMatch> matches = findPatchMatches(oldData, oldSize, newData, newSize);
+  std::vector<char> body;
+  body.reserve(newSize + 24 * (matches.size() + 1));
+  if(matches.empty())
+    matches.push_back({0, 0, std::min(oldSize, newSize)});
+  else {
+    // the first control block only moves to where the first match starts in oldData
+    appendControl(body, 0, matches[0].newStart, matches[0].oldStart);
+    body.insert(body.end(), newData, newData + matches[0].newStart);
+  }
+  for(size_t i = 0; i < matches.size(); i++) {
+    const patchMatch& match = matches[i];
+    uint64_t nextNew = i + 1 < matches.size() ? matches[i + 1].newStart : newSize;
+    uint64_t nextOld = i + 1 < matches.size() ? matches[i + 1].oldStart : match.oldStart + match.len;
+    uint64_t extraLen = nextNew - match.newStart - match.len;
+    appendControl(body, match.len, extraLen, (int64_t)nextOld - (int64_t)(match.oldStart + match.len));
+    for(uint64_t k = 0; k < match.len; k++)
+      body.push_back(newData[match.newStart + k] - oldData[match.oldStart + k]);
+    body.insert(body.end(), newData + match.newStart + match.len, newData + nextNew);
+  }
+
+  patchHeader header;
+  memcpy(header.magic, patchMagic, sizeof(patchMagic));
+  header.newSize = newSize;
+  header.oldSize = oldSize;
+  header.bodySize = body.size();
+  std::vector<char> patch(sizeof(header) + ZSTD_compressBound(body.size()));
+  memcpy(patch.data(), &header, sizeof(header));
+  size_t compSize = ZSTD_compress(patch.data() + sizeof(header), patch.size() - sizeof(header), body.data(), body.size(), level);
+  if(ZSTD_isError(compSize))
+    return std::vector<char>();
+  patch.resize(sizeof(header) + compSize);
+  return patch;
+}
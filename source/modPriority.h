@@ -0,0 +1,44 @@
+#pragma once
+#include <stdio.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+// Mod folder names, highest priority first. Folders not listed rank below all listed ones.
+const char* priorityPath = "sdmc:/UltimateModManager/priority.txt";
+
+std::vector<std::string> loadPriority() {
+  std::vector<std::string> priority;
+  FILE* f = fopen(priorityPath, "r");
+  if(!f) return priority;
+  char line[0x130];
+  while(fgets(line, sizeof(line), f)) {
+    std::string mod = line;
+    mod.erase(mod.find_last_not_of("\r\n") + 1);
+    if(!mod.empty()) priority.push_back(mod);
+  }
+  fclose(f);
+  return priority;
+}
+
+void savePriority(const std::vector<std::string>& priority) {
+  FILE* f = fopen(priorityPath, "w");
+  if(!f) return;
+  for(const std::string& mod : priority)
+    fprintf(f, "%s\n", mod.c_str());
+  fclose(f);
+}
+
+// Orders folder names by priority, unlisted folders alphabetically after the listed ones
+void sortByPriority(std::vector<std::string>& mods, const std::vector<std::string>& priority) {
+  std::map<std::string, size_t> rank;
+  for(size_t i = 0; i < priority.size(); i++)
+    rank.emplace(priority[i], i);
+  std::sort(mods.begin(), mods.end(), [&rank](const std::string& a, const std::string& b) {
+    auto rankA = rank.find(a), rankB = rank.find(b);
+    if(rankA != rank.end() && rankB != rank.end()) return rankA->second < rankB->second;
+    if(rankA != rank.end() || rankB != rank.end()) return rankA != rank.end();
+    return a < b;
+  });
+}
@@ -0,0 +1,81 @@
+#pragma once
+#include <dirent.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+/*
+ * A profile is a named list of mod folders, stored as profiles/<name>.txt with one
+ * folder name per line. The first line has the highest priority and wins any overlap.
+ */
+const char* profiles_root = "sdmc:/UltimateModManager/profiles/";
+const char* activeProfilePath = "sdmc:/UltimateModManager/profiles/active";
+
+std::vector<std::string> listProfiles() {
+  std::vector<std::string> profiles;
+  DIR* d = opendir(profiles_root);
+  if(!d) return profiles;
+  struct dirent* dir;
+  while((dir = readdir(d)) != NULL) {
+    std::string name = dir->d_name;
+    if(dir->d_type != DT_DIR && name.size() > 4 && name.compare(name.size() - 4, 4, ".txt") == 0)
+      profiles.push_back(name.substr(0, name.size() - 4));
+  }
+  closedir(d);
+  std::sort(profiles.begin(), profiles.end());
+  return profiles;
+}
+
+std::vector<std::string> loadProfile(const std::string& name) {
+  std::vector<std::string> mods;
+  FILE* f = fopen((std::string(profiles_root) + name + ".txt").c_str(), "r");
+  if(!f) return mods;
+  char line[0x130];
+  while(fgets(line, sizeof(line), f)) {
+    std::string mod = line;
+    mod.erase(mod.find_last_not_of("\r\n/") + 1);
+    if(!mod.empty()) mods.push_back(mod);
+  }
+  fclose(f);
+  return mods;
+}
+
+bool saveProfile(const std::string& name, const std::vector<std::string>& mods) {
+  mkdir(profiles_root, 0777);
+  FILE* f = fopen((std::string(profiles_root) + name + ".txt").c_str(), "w");
+  if(!f) return false;
+  for(const std::string& mod : mods)
+    fprintf(f, "%s\n", mod.c_str());
+  fclose(f);
+  return true;
+}
+
+// Picks the first unused profile<N> name
+std::string newProfileName() {
+  std::vector<std::string> profiles = listProfiles();
+  for(int i = 1;; i++) {
+    std::string name = "profile" + std::to_string(i);
+    if(std::find(profiles.begin(), profiles.end(), name) == profiles.end())
+      return name;
+  }
+}
+
+std::string activeProfile() {
+  char line[0x130] = {0};
+  FILE* f = fopen(activeProfilePath, "r");
+  if(!f) return "";
+  fgets(line, sizeof(line), f);
+  fclose(f);
+  std::string name = line;
+  name.erase(name.find_last_not_of("\r\n") + 1);
+  return name;
+}
+
+void setActiveProfile(const std::string& name) {
+  FILE* f = fopen(activeProfilePath, "w");
+  if(!f) return;
+  fprintf(f, "%s\n", name.c_str());
+  fclose(f);
+}
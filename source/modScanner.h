@@ -0,0 +1,219 @@
+#pragma once
+#include <switch.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+/*
+ * Walks a mod folder into a flat list of files. Folders are shared between a few threads
+ * through a work queue, so the SD card always has several directory reads in flight.
+ * Paths are relative to the scanned folder and live in per-thread arenas, they stay
+ * valid for as long as the modScan does.
+ */
+#define SCAN_THREADS 3
+#define SCAN_STACK_SIZE 0x8000
+#define SCAN_ARENA_BLOCK 0x10000
+#define SCAN_PATH_SIZE 0x301
+
+struct scannedFile {
+  const char* path;  // relative to the scanned folder
+  const char* name;  // points into path
+};
+
+// Append-only string storage, blocks are never moved so returned pointers stay valid
+class pathArena {
+public:
+  pathArena() {}
+  pathArena(const pathArena&) = delete;
+  pathArena& operator=(const pathArena&) = delete;
+  ~pathArena() {
+    for(char* block : blocks)
+      delete[] block;
+  }
+
+  // Stores "dir/name", or just name if dir is empty
+  const char* join(const char* dir, const char* name) {
+    size_t dirLen = strlen(dir);
+    size_t nameLen = strlen(name);
+    size_t size = dirLen + (dirLen != 0) + nameLen + 1;
+    if(blocks.empty() || used + size > SCAN_ARENA_BLOCK) {
+      blocks.push_back(new char[std::max(size, (size_t)SCAN_ARENA_BLOCK)]);
+      used = 0;
+    }
+    char* out = blocks.back() + used;
+    used += size;
+    if(dirLen != 0) {
+      memcpy(out, dir, dirLen);
+      out[dirLen] = '/';
+      dirLen++;
+    }
+    memcpy(out + dirLen, name, nameLen + 1);
+    return out;
+  }
+
+private:
+  std::vector<char*> blocks;
+  size_t used = 0;
+};
+
+class modScan {
+public:
+  std::vector<scannedFile> files;
+  size_t dirs = 0;
+  u64 newest = 0;  // newest mtime of the folders read
+  double seconds = 0;
+
+  modScan() { mutexInit(&lock); }
+  modScan(const modScan&) = delete;
+  modScan& operator=(const modScan&) = delete;
+
+  // Returns false if root could not be opened. root should not end in '/'.
+  bool scan(const std::string& root) {
+    auto start = std::chrono::steady_clock::now();
+    this->root = root;
+    files.clear();
+    dirs = 0;
+    newest = 0;
+    opened = true;
+    queue.assign(1, "");
+    active = 0;
+
+    Thread threads[SCAN_THREADS];
+    worker args[SCAN_THREADS];
+    int started = 0;
+    for(int i = 0; i < SCAN_THREADS; i++) {
+      args[started] = {this, &arenas[started], {}, 0, 0};
+      if(R_SUCCEEDED(threadCreate(&threads[started], scanWorker, &args[started], SCAN_STACK_SIZE, 0x2C, i))) {
+        if(R_SUCCEEDED(threadStart(&threads[started]))) started++;
+        else threadClose(&threads[started]);
+      }
+    }
+    if(started == 0) {
+      args[0] = {this, &arenas[0], {}, 0, 0};
+      scanWorker(&args[0]);
+      started = 1;
+    }
+    else {
+      for(int i = 0; i < started; i++) {
+        threadWaitForExit(&threads[i]);
+        threadClose(&threads[i]);
+      }
+    }
+    for(int i = 0; i < started; i++) {
+      files.insert(files.end(), args[i].files.begin(), args[i].files.end());
+      dirs += args[i].dirs;
+      newest = std::max(newest, args[i].newest);
+    }
+    seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return opened;
+  }
+
+private:
+  struct worker {
+    modScan* scan;
+    pathArena* arena;
+    std::vector<scannedFile> files;
+    size_t dirs;
+    u64 newest;
+  };
+
+  std::string root;
+  Mutex lock;
+  std::vector<const char*> queue;  // folders left to read, relative to root
+  size_t active = 0;               // folders being read, which may still add to the queue
+  bool opened = true;
+  pathArena arenas[SCAN_THREADS];
+
+  // Takes the next folder, waiting while other threads may still find more.
+  // Returns nullptr once the whole tree has been read.
+  const char* next() {
+    while(true) {
+      mutexLock(&lock);
+      if(!queue.empty()) {
+        const char* dir = queue.back();
+        queue.pop_back();
+        active++;
+        mutexUnlock(&lock);
+        return dir;
+      }
+      bool done = active == 0;
+      mutexUnlock(&lock);
+      if(done)
+        return nullptr;
+      svcSleepThread(1000000);
+    }
+  }
+
+  void readDir(worker& w, const char* relDir) {
+    char absPath[SCAN_PATH_SIZE];
+    int len = snprintf(absPath, sizeof(absPath), "%s%s%s", root.c_str(), relDir[0] ? "/" : "", relDir);
+    DIR* d = len < (int)sizeof(absPath) ? opendir(absPath) : nullptr;
+    if(!d) {
+      if(relDir[0] == 0) opened = false;
+      return;
+    }
+    w.dirs++;
+    struct stat dirStat;
+    if(stat(absPath, &dirStat) == 0)
+      w.newest = std::max(w.newest, (u64)dirStat.st_mtime);
+    struct dirent* dir;
+    std::vector<const char*> found;
+    while((dir = readdir(d)) != NULL) {
+      if(strcmp(dir->d_name, ".") == 0 || strcmp(dir->d_name, "..") == 0)
+        continue;
+      bool isDir = dir->d_type == DT_DIR;
+      if(dir->d_type == DT_UNKNOWN) {
+        char entryPath[SCAN_PATH_SIZE];
+        struct stat st;
+        if(snprintf(entryPath, sizeof(entryPath), "%s/%s", absPath, dir->d_name) >= (int)sizeof(entryPath))
+          continue;  // too long to stat, or to open later
+        isDir = stat(entryPath, &st) == 0 && S_ISDIR(st.st_mode);
+      }
+      const char* path = w.arena->join(relDir, dir->d_name);
+      if(isDir)
+        found.push_back(path);
+      else
+        w.files.push_back({path, path + strlen(path) - strlen(dir->d_name)});
+    }
+    closedir(d);
+    if(!found.empty()) {
+      mutexLock(&lock);
+      queue.insert(queue.end(), found.begin(), found.end());
+      mutexUnlock(&lock);
+    }
+  }
+
+  static void scanWorker(void* arg) {
+    worker& w = *(worker*)arg;
+    modScan& scan = *w.scan;
+    for(const char* dir = scan.next(); dir != nullptr; dir = scan.next()) {
+      scan.readDir(w, dir);
+      mutexLock(&scan.lock);
+      scan.active--;
+      mutexUnlock(&scan.lock);
+    }
+  }
+};
+
+// Totals of the scans since the last report, for printing how long finding the files took
+size_t scannedFiles = 0;
+size_t scannedDirs = 0;
+double scanSeconds = 0;
+
+void countScan(const modScan& scan) {
+  scannedFiles += scan.files.size();
+  scannedDirs += scan.dirs;
+  scanSeconds += scan.seconds;
+}
+
+void printScanTime() {
+  if(scannedDirs > 0)
+    printf("Scanned %lu file(s) in %lu folder(s) in %.1f ms\n\n", scannedFiles, scannedDirs, scanSeconds * 1000);
+  scannedFiles = scannedDirs = 0;
+  scanSeconds = 0;
+}
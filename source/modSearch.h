@@ -0,0 +1,105 @@
+#pragma once
+#include <ctype.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <set>
+#include <string>
+#include <vector>
+
+/*
+ * Search over the mod menu. Each mod is matched on its folder name and on the fighters and
+ * stages its files replace. Every space separated word of the query has to appear in one of
+ * them. Mods whose name starts with the first word are listed first, the rest keep their
+ * priority order. A query that extends the previous one only rechecks the previous matches.
+ */
+
+// Adds the fighter or stage a data.arc path belongs to, e.g. "mario" for fighter/mario/model/...
+void addArcPathTag(std::set<std::string>& tags, const std::string& arcPath) {
+  const char* kinds[] = {"fighter/", "stage/"};
+  for(const char* kind : kinds) {
+    size_t kindLen = strlen(kind);
+    if(arcPath.compare(0, kindLen, kind) != 0)
+      continue;
+    size_t end = arcPath.find('/', kindLen);
+    if(end != std::string::npos && end > kindLen)
+      tags.insert(arcPath.substr(kindLen, end - kindLen));
+  }
+}
+
+std::string joinTags(const std::set<std::string>& tags) {
+  std::string out;
+  for(const std::string& tag : tags)
+    out += (out.empty() ? "" : " ") + tag;
+  return out;
+}
+
+class modSearch {
+public:
+  std::string query;
+  std::vector<uint32_t> matches;  // indices into the names given to build(), best first
+
+  bool active() const { return !query.empty(); }
+
+  // tags[i] are the space separated fighters and stages of names[i]. The current query is kept.
+  void build(const std::vector<std::string>& names, const std::vector<std::string>& tags) {
+    keys.resize(names.size());
+    nameLens.resize(names.size());
+    for(size_t i = 0; i < names.size(); i++) {
+      keys[i] = lower(names[i]) + "\t" + lower(tags[i]);
+      nameLens[i] = names[i].size();
+    }
+    std::string current = query;
+    query.clear();
+    setQuery(current);
+  }
+
+  void setQuery(const std::string& newQuery) {
+    std::string q = lower(newQuery);
+    size_t first = q.find_first_not_of(' ');
+    q = first == std::string::npos ? "" : q.substr(first, q.find_last_not_of(' ') - first + 1);
+    bool narrowing = !query.empty() && q.compare(0, query.size(), query) == 0;
+    query = q;
+    std::vector<std::string> words;
+    for(size_t pos = 0; pos < q.size();) {
+      size_t end = q.find(' ', pos);
+      if(end == std::string::npos) end = q.size();
+      if(end > pos) words.push_back(q.substr(pos, end - pos));
+      pos = end + 1;
+    }
+    std::vector<uint32_t> found;
+    if(narrowing) {
+      for(uint32_t i : candidates)
+        if(matchesAll(i, words)) found.push_back(i);
+    }
+    else {
+      for(uint32_t i = 0; i < keys.size(); i++)
+        if(matchesAll(i, words)) found.push_back(i);
+    }
+    candidates = found;
+    matches = found;
+    if(!words.empty()) {
+      const std::string& first = words[0];
+      std::stable_partition(matches.begin(), matches.end(), [&](uint32_t i) {
+        return nameLens[i] >= first.size() && keys[i].compare(0, first.size(), first) == 0;
+      });
+    }
+  }
+
+private:
+  std::vector<std::string> keys;     // lowercase "name\ttags"
+  std::vector<size_t> nameLens;
+  std::vector<uint32_t> candidates;  // matches of query in priority order
+
+  static std::string lower(const std::string& str) {
+    std::string out = str;
+    for(char& c : out) c = tolower((unsigned char)c);
+    return out;
+  }
+
+  bool matchesAll(uint32_t i, const std::vector<std::string>& words) const {
+    for(const std::string& word : words)
+      if(keys[i].find(word) == std::string::npos) return false;
+    return true;
+  }
+};
@@ -0,0 +1,247 @@
+#pragma once
+#include <switch.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+#include "utils.h"
+#include "offsetFile.h"
+#include "modPatch.h"
+#include "modArchive.h"
+#include "ummPackage.h"
+#include "modScanner.h"
+#include "installTimings.h"
+
+// A single mod file and the data.arc region it will overwrite
+struct modTarget {
+  u64 offset;
+  u64 size;             // size of the region in data.arc
+  u64 decompSize;       // from Offsets.txt, 0 for files named by offset
+  std::string arcPath;  // path relative to the mod folder, including any .ummpatch suffix
+  std::string filePath; // absolute path to the mod file, or <archive path>/<arcPath> for archives
+  modArchive* archive = nullptr;        // set for files inside a .zip or .tar
+  const archiveEntry* entry = nullptr;
+  ummPackage* package = nullptr;        // set for files inside a .umm package
+  const ummEntry* packed = nullptr;
+};
+
+struct targetConflict {
+  u64 offset;
+  u64 end;
+  std::vector<std::pair<std::string, const modTarget*>> writers;  // in write order, last one wins
+};
+
+// Scan results of each mod folder, so reanalysing a selection does not touch the SD card again
+std::map<std::string, std::vector<modTarget>> modTargetCache;
+// Files of each scanned mod folder whose data.arc offset could not be found
+std::map<std::string, std::vector<std::string>> unresolvedCache;
+// Archives and packages stay open for as long as their targets are cached
+std::map<std::string, modArchive*> archiveCache;
+std::map<std::string, ummPackage*> packageCache;
+// Newest folder mtime of each scanned mod folder, or the mtime of a packed mod
+std::map<std::string, u64> modStampCache;
+
+void clearModTargetCache() {
+  modTargetCache.clear();
+  unresolvedCache.clear();
+  modStampCache.clear();
+  for(auto& [modDir, archive] : archiveCache)
+    delete archive;
+  archiveCache.clear();
+  for(auto& [modDir, package] : packageCache)
+    delete package;
+  packageCache.clear();
+}
+
+// Mods that are a single file rather than a folder
+bool isPackedMod(const std::string& name) {
+  return isModArchive(name) || isModPackage(name);
+}
+
+// Finds the region a file named fileName at target.arcPath overwrites
+bool resolveTarget(modTarget& target, const char* fileName, offsetFile* offsets) {
+  target.offset = isPatchFile(target.arcPath) ? 0 : hex_to_u64(fileName);
+  target.size = 0;
+  target.decompSize = 0;
+  if(!target.offset && offsets != nullptr) {
+    std::array<u64, 3> fileData = offsets->getKey(patchTarget(target.arcPath));
+    target.offset = fileData[0];
+    target.size = fileData[1];
+    target.decompSize = fileData[2];
+  }
+  return target.offset != 0;
+}
+
+// Returns the newest folder mtime in the mod
+u64 collectModTargets(const std::string& modRoot, offsetFile* offsets, std::vector<modTarget>& targets,
+                      std::vector<std::string>& unresolved) {
+  modScan scan;
+  {
+    phaseTimer timer(PHASE_SCAN);
+    scan.scan(modRoot);
+  }
+  countScan(scan);
+  phaseTimer timer(PHASE_LOOKUP);
+  for(const scannedFile& file : scan.files) {
+    modTarget target;
+    target.arcPath = file.path;
+    target.filePath = modRoot + "/" + file.path;
+    if(!resolveTarget(target, file.name, offsets)) {
+      unresolved.push_back(target.arcPath);
+      continue;
+    }
+    if(target.size == 0) {
+      struct stat st;
+      if(stat(target.filePath.c_str(), &st) == 0) target.size = st.st_size;
+    }
+    targets.push_back(target);
+  }
+  return scan.newest;
+}
+
+// Archives made by zipping the mod folder itself have one extra top level folder,
+// so entry names that do not resolve are retried without it.
+void collectArchiveTargets(const std::string& rootDir, const std::string& modDir, offsetFile* offsets, std::vector<modTarget>& targets,
+                           std::vector<std::string>& unresolved) {
+  phaseTimer timer(PHASE_LOOKUP);
+  modArchive* archive = new modArchive(rootDir + modDir);
+  archiveCache[modDir] = archive;
+  for(const archiveEntry& entry : archive->entries) {
+    modTarget target;
+    target.archive = archive;
+    target.entry = &entry;
+    target.arcPath = entry.name;
+    const char* fileName = entry.name.c_str() + entry.name.find_last_of('/') + 1;
+    bool found = resolveTarget(target, fileName, offsets);
+    size_t topDir = entry.name.find('/');
+    if(!found && topDir != std::string::npos) {
+      target.arcPath = entry.name.substr(topDir + 1);
+      found = resolveTarget(target, fileName, offsets);
+    }
+    if(!found) {
+      unresolved.push_back(entry.name);
+      continue;
+    }
+    target.filePath = archive->path + "/" + target.arcPath;
+    if(target.size == 0) target.size = entry.size;
+    targets.push_back(target);
+  }
+}
+
+// Package entries are already compressed for one game version, so an entry whose sizes
+// in Offsets.txt differ is left out rather than placed by its arc path.
+void collectPackageTargets(const std::string& rootDir, const std::string& modDir, offsetFile* offsets, std::vector<modTarget>& targets,
+                           std::vector<std::string>& unresolved) {
+  phaseTimer timer(PHASE_LOOKUP);
+  ummPackage* package = new ummPackage(rootDir + modDir);
+  packageCache[modDir] = package;
+  char name[0x20];
+  for(const ummEntry& entry : package->entries) {
+    modTarget target;
+    target.package = package;
+    target.packed = &entry;
+    target.arcPath = entry.arcPath;
+    target.offset = entry.offset;
+    target.size = entry.compSize;
+    target.decompSize = entry.decompSize;
+    if(!entry.arcPath.empty() && offsets != nullptr) {
+      std::array<u64, 3> fileData = offsets->getKey(entry.arcPath);
+      // compressed payloads fill their region exactly, uncompressed ones may be shorter
+      bool fits = fileData[1] != fileData[2] ? fileData[1] == entry.compSize : entry.compSize <= fileData[1];
+      if(fileData[0] != 0 && (fileData[2] != entry.decompSize || !fits)) {
+        unresolved.push_back(entry.arcPath + " (built for another game version)");
+        continue;
+      }
+      if(fileData[0] != 0) target.offset = fileData[0];
+    }
+    if(entry.arcPath.empty()) {
+      snprintf(name, sizeof(name), "0x%lx", entry.offset);
+      target.arcPath = name;
+    }
+    target.filePath = package->path + "/" + target.arcPath;
+    targets.push_back(target);
+  }
+}
+
+// modDir is relative to manager_root, e.g. "mods/<name>"
+const std::vector<modTarget>& getModTargets(const std::string& rootDir, const std::string& modDir, offsetFile* offsets) {
+  auto it = modTargetCache.find(modDir);
+  if(it != modTargetCache.end())
+    return it->second;
+  std::vector<modTarget>& targets = modTargetCache[modDir];
+  if(isModPackage(modDir)) {
+    collectPackageTargets(rootDir, modDir, offsets, targets, unresolvedCache[modDir]);
+    modStampCache[modDir] = packageCache[modDir]->mtime;
+  }
+  else if(isModArchive(modDir)) {
+    collectArchiveTargets(rootDir, modDir, offsets, targets, unresolvedCache[modDir]);
+    modStampCache[modDir] = archiveCache[modDir]->mtime;
+  }
+  else
+    modStampCache[modDir] = collectModTargets(rootDir + modDir, offsets, targets, unresolvedCache[modDir]);
+  std::sort(targets.begin(), targets.end(), [](const modTarget& a, const modTarget& b) { return a.offset < b.offset; });
+  return targets;
+}
+
+// modDirs must be in the order they will be written. Regions that overlap between
+// different mods are grouped into one conflict each.
+std::vector<targetConflict> findConflicts(const std::string& rootDir, const std::vector<std::string>& modDirs, offsetFile* offsets) {
+  struct entry { u64 offset; u64 end; u32 modIDX; const modTarget* target; };
+  std::vector<entry> entries;
+  for(u32 i = 0; i < modDirs.size(); i++) {
+    for(const modTarget& target : getModTargets(rootDir, modDirs[i], offsets))
+      entries.push_back({target.offset, target.offset + target.size, i, &target});
+  }
+  std::sort(entries.begin(), entries.end(), [](const entry& a, const entry& b) {
+    return a.offset != b.offset ? a.offset < b.offset : a.modIDX < b.modIDX;
+  });
+
+  std::vector<targetConflict> conflicts;
+  size_t clusterStart = 0;
+  u64 clusterEnd = 0;
+  for(size_t i = 0; i <= entries.size(); i++) {
+    if(i < entries.size() && i > clusterStart && entries[i].offset < clusterEnd) {
+      clusterEnd = std::max(clusterEnd, entries[i].end);
+      continue;
+    }
+    // close the previous cluster, it is a conflict if more than one mod writes to it
+    bool multipleMods = false;
+    for(size_t j = clusterStart + 1; j < i; j++)
+      multipleMods |= entries[j].modIDX != entries[clusterStart].modIDX;
+    if(multipleMods) {
+      targetConflict conflict;
+      conflict.offset = entries[clusterStart].offset;
+      conflict.end = clusterEnd;
+      std::vector<entry> writers(entries.begin() + clusterStart, entries.begin() + i);
+      std::stable_sort(writers.begin(), writers.end(), [](const entry& a, const entry& b) { return a.modIDX < b.modIDX; });
+      for(const entry& e : writers)
+        conflict.writers.push_back({modDirs[e.modIDX], e.target});
+      conflicts.push_back(conflict);
+    }
+    if(i < entries.size()) {
+      clusterStart = i;
+      clusterEnd = entries[i].end;
+    }
+  }
+  return conflicts;
+}
+
+// Resolves the selected mods into the single winning file for each region.
+// modDirs is in priority order, the first one wins any overlap.
+std::map<u64, const modTarget*> resolveTargets(const std::string& rootDir, const std::vector<std::string>& modDirs, offsetFile* offsets) {
+  std::map<u64, const modTarget*> resolved;
+  for(auto modDir = modDirs.rbegin(); modDir != modDirs.rend(); ++modDir) {
+    for(const modTarget& target : getModTargets(rootDir, *modDir, offsets)) {
+      // drop lower priority regions that this one overlaps
+      auto it = resolved.lower_bound(target.offset + std::max(target.size, (u64)1));
+      while(it != resolved.begin()) {
+        --it;
+        if(it->first + it->second->size <= target.offset) break;
+        it = resolved.erase(it);
+      }
+      resolved[target.offset] = &target;
+    }
+  }
+  return resolved;
+}
@@ -4,34 +4,111 @@
 #include <stdlib.h>
 #include <string.h>
 #include <algorithm>
-#include <list>
+#include <atomic>
 #define ZSTD_STATIC_LINKING_ONLY
 #include <zstd.h>
 #include <experimental/filesystem>
 #include "utils.h"
+#include "zstdFrame.h"
 #include "offsetFile.h"
+#include "config.h"
+#include "backupCodec.h"
+#include "installJournal.h"
+#include "modTargets.h"
+#include "installManifest.h"
+#include "installCheckpoint.h"
+#include "installEstimate.h"
+#include "vanillaArc.h"
+#include "modProfiles.h"
+#include "modPriority.h"
+#include "modPatch.h"
+#include "installVerify.h"
+#include "memoryBudget.h"
+#include "modIndex.h"
+#include "modSearch.h"
+#include "installWorker.h"
+#include "installTimings.h"
 
 #define FILENAME_SIZE 0x130
 #define FILE_READ_SIZE 0x20000
+#define RESTORE_RUN_SIZE 0x800000
+#define INDEXER_STACK_SIZE 0x20000
+#define MENU_ROWS 40
 
 #define INSTALL false
 #define UNINSTALL true
 
 bool installing = INSTALL;
 bool deleteMod = false;
+bool dryRun = false;
 
-char** mod_dirs = NULL;
-size_t num_mod_dirs = 0;
+// Selected mod folders relative to manager_root in modFolders order, then "backups" if it
+// is under the cursor. Overlaps are resolved by selectedByPriority(), not by this order.
+std::vector<std::string> mod_dirs;
+std::string cursorModDir;  // the folder under the cursor, what deleteMod removes
 bool installation_finish = false;
 s64 mod_folder_index = 0;
 offsetFile* offsetObj = nullptr;
+configFile* configObj = nullptr;
 ZSTD_CCtx* compContext = nullptr;
-std::list<s64> installIDXs;
+// Mod folders and profiles shown in the menu. They are read from the SD card when the menu
+// is opened, after anything the installer changes and when R3 is pressed, not every frame.
+std::vector<std::string> modFolders;
+std::vector<std::string> menuProfiles;
+std::string menuActiveProfile;
+bool modFoldersFound = false;
+bool modFoldersStale = true;
+std::vector<bool> selectedFolders;  // multi-selection, by index in modFolders
+// "mods/<name>" of the multi-selection, lowest priority first, rebuilt when selectionChanged is set
+std::vector<std::string> selectedDirs;
+bool selectionChanged = true;
+size_t selectionConflicts = 0;
+modSearch search;
+bool searchStale = true;  // rebuilt after the folder list or the index changes
+s64 menu_scroll = 0;
+
+// A backup waiting to be written back by bulk_restore()
+struct pendingRestore {
+    u64 offset;
+    u64 size;
+    std::string path;
+    bool restored;
+};
+std::vector<pendingRestore> pendingRestores;
+bool restoreAllBackups = false;
+bool restoreAllRegions = false;
 
 const char* manager_root = "sdmc:/UltimateModManager/";
 const char* mods_root = "sdmc:/UltimateModManager/mods/";
 const char* backups_root = "sdmc:/UltimateModManager/backups/";
 const char* offsetDBPath = "sdmc:/UltimateModManager/Offsets.txt";
+const char* configPath = "sdmc:/UltimateModManager/config.txt";
+const char* dryRunReportPath = "sdmc:/UltimateModManager/dryrun.json";
+const char* backupTempPath = "sdmc:/UltimateModManager/backup.tmp";
+const char* compressTempPath = "sdmc:/UltimateModManager/compress.tmp";
+const char* reportsRoot = "sdmc:/UltimateModManager/reports/";
+const char* compStatsPath = "sdmc:/UltimateModManager/compstats.txt";
+installManifest manifest("sdmc:/UltimateModManager/installed.txt");
+modIndex modIndexObj("sdmc:/UltimateModManager/modindex.txt");
+
+void loadConfig() {
+    if(configObj != nullptr) delete configObj;
+    configObj = new configFile(configPath);
+    std::string mode = configObj->getString("backup_compression", "off");
+    if(mode == "auto") backupCompression = BACKUP_COMPRESSION_AUTO;
+    else if(mode == "on") backupCompression = BACKUP_COMPRESSION_ON;
+    else backupCompression = BACKUP_COMPRESSION_OFF;
+    backupMode = configObj->getString("backup_mode", "sd") == "romfs" ? BACKUP_MODE_ROMFS : BACKUP_MODE_SD;
+    vanillaArcPath = configObj->getString("vanilla_arc", "");
+    std::string problem = vanillaArcConfigProblem(vanillaArcPath);
+    if(backupMode == BACKUP_MODE_ROMFS && !problem.empty()) {
+        printf(CONSOLE_YELLOW "backup_mode=romfs needs vanilla_arc set to an unmodified copy of data.arc (%s).\n"
+               "Backing up to the SD card instead.\n" CONSOLE_RESET, problem.c_str());
+        backupMode = BACKUP_MODE_SD;
+    }
+    verifyInstall = configObj->getBool("verify_install", false);
+    memoryBudget = configObj->getInt("memory_budget_mb", 0) * 0x100000;
+}
 
 int seek_files(FILE* f, uint64_t offset, FILE* arc) {
     // Set file pointers to start of file and offset respectively
@@ -50,6 +127,17 @@ int seek_files(FILE* f, uint64_t offset, FILE* arc) {
     return 0;
 }
 
+void loadOffsets(bool quiet = false) {
+    if(offsetObj == nullptr && std::filesystem::exists(offsetDBPath)) {
+        if(!quiet) {
+            printf("Parsing Offsets.txt\n");
+            refreshConsole();
+        }
+        phaseTimer timer(PHASE_LOOKUP);
+        offsetObj = new offsetFile(offsetDBPath);
+    }
+}
+
 bool ZSTDFileIsFrame(const char* filePath) {
   const size_t magicSize = 4;
   unsigned char buf[magicSize];
@@ -59,69 +147,447 @@ bool ZSTDFileIsFrame(const char* filePath) {
   return ZSTD_isFrame(buf, magicSize);
 }
 
-char* compressFile(const char* path, u64 compSize, u64 &dataSize)  // returns pointer to heap
+char* compressBuffer(const char* inBuff, u64 inSize, u64 compSize, u64 &dataSize)  // returns pointer to heap, free with budgetFree(buf, compSize+1)
 {
-  char* outBuff = new char[compSize+1];
+  if(compContext == nullptr) compContext = ZSTD_createCCtx();
+  phaseTimer timer(PHASE_COMPRESS);
+  timer.bytes = inSize;
+  char* outBuff = budgetAlloc(compSize+1);
+  if(outBuff != nullptr && !compressFrame(compContext, inBuff, inSize, outBuff, compSize, dataSize))
+  {
+    budgetFree(outBuff, compSize+1);
+    outBuff = nullptr;
+  }
+  timeCompressedFile(inSize, outBuff != nullptr ? dataSize : 0, compSize);
+  return outBuff;
+}
+
+char* compressFile(const char* path, u64 compSize, u64 &dataSize, u64* srcHash = nullptr)  // returns pointer to heap, nullptr on failure
+{
+  phaseTimer timer(PHASE_READ);
   FILE* inFile = fopen(path, "rb");
+  if(inFile == nullptr)
+  {
+    printf(CONSOLE_RED "Failed to open '%s'\n" CONSOLE_RESET, path);
+    return nullptr;
+  }
   fseek(inFile, 0, SEEK_END);
   u64 inSize = ftell(inFile);
   fseek(inFile, 0, SEEK_SET);
-  char* inBuff = new char[inSize];
-  fread(inBuff, sizeof(char), inSize, inFile);
-  fclose(inFile);
-  int compLvl = 3;
-  if(compContext == nullptr) compContext = ZSTD_createCCtx();
-  ZSTD_parameters params;
-  params.fParams = {0,0,1};  // Minimize header size
-  do
+  char* inBuff = budgetAlloc(inSize);
+  if(inBuff == nullptr || fread(inBuff, sizeof(char), inSize, inFile) != inSize)
   {
-    params.cParams = ZSTD_getCParams(compLvl++, inSize, 0);
-    dataSize = ZSTD_compress_advanced(compContext, outBuff, compSize+1, inBuff, inSize, nullptr, 0, params);
-    if(compLvl==8) compLvl = 17;  // skip arbitrary amount of levels for speed.
+    printf(CONSOLE_RED "Failed to read '%s'\n" CONSOLE_RESET, path);
+    budgetFree(inBuff, inSize);
+    fclose(inFile);
+    return nullptr;
   }
-  while ((dataSize > compSize || ZSTD_isError(dataSize)) && compLvl <= ZSTD_maxCLevel());
-  //printf("Compression level: %d\n", compLvl-1);
-  if(dataSize > compSize || ZSTD_isError(dataSize))
+  fclose(inFile);
+  timer.bytes = inSize;
+  if(srcHash != nullptr) *srcHash = xxhash64::hash(inBuff, inSize);
+  char* outBuff = compressBuffer(inBuff, inSize, compSize, dataSize);
+  budgetFree(inBuff, inSize);
+  return outBuff;
+}
+
+// Compresses a file too large for the memory budget into compressTempPath, streaming it
+// at the same levels compressFile() tries. Returns the frame size, or 0 if it never fits.
+u64 compress_to_temp(const char* path, u64 modSize, u64 compSize, u64* srcHash)
+{
+  if(compContext == nullptr) compContext = ZSTD_createCCtx();
+  phaseTimer timer(PHASE_COMPRESS);
+  timer.bytes = modSize;
+  budgetBuffer inBuffer(ZSTD_CStreamInSize());
+  budgetBuffer outBuffer(ZSTD_CStreamOutSize());
+  char* inBuf = inBuffer.data;
+  char* outBuf = outBuffer.data;
+  size_t inChunk = inBuffer.size;
+  size_t outChunk = outBuffer.size;
+  u64 dataSize = 0;
+  for(int compLvl = 3; compLvl != 0; compLvl = nextFrameLevel(compLvl))
   {
-    delete[] outBuff;
-    outBuff = nullptr;
+    auto start = std::chrono::steady_clock::now();
+    FILE* in = fopen(path, "rb");
+    FILE* out = fopen(compressTempPath, "wb");
+    if(in == nullptr || out == nullptr)
+    {
+      if(in) fclose(in);
+      if(out) fclose(out);
+      dataSize = 0;
+      break;
+    }
+    ZSTD_CCtx_reset(compContext, ZSTD_reset_session_and_parameters);
+    ZSTD_CCtx_setParameter(compContext, ZSTD_c_compressionLevel, compLvl);
+    ZSTD_CCtx_setParameter(compContext, ZSTD_c_contentSizeFlag, 0);  // Minimize header size
+    ZSTD_CCtx_setParameter(compContext, ZSTD_c_dictIDFlag, 0);
+    ZSTD_CCtx_setPledgedSrcSize(compContext, modSize);
+    xxhash64 hash;
+    bool failed = false;
+    size_t size;
+    dataSize = 0;
+    do
+    {
+      size = fread(inBuf, 1, inChunk, in);
+      hash.update(inBuf, size);
+      ZSTD_EndDirective mode = size < inChunk ? ZSTD_e_end : ZSTD_e_continue;
+      ZSTD_inBuffer input = {inBuf, size, 0};
+      bool finished;
+      do
+      {
+        ZSTD_outBuffer output = {outBuf, outChunk, 0};
+        size_t remaining = ZSTD_compressStream2(compContext, &output, &input, mode);
+        if(ZSTD_isError(remaining))
+        {
+          failed = true;
+          break;
+        }
+        fwrite(outBuf, 1, output.pos, out);
+        dataSize += output.pos;
+        finished = mode == ZSTD_e_end ? remaining == 0 : input.pos == input.size;
+      }
+      while(!finished);
+    }
+    while(!failed && size == inChunk && dataSize <= compSize);  // stop early once it can not fit
+    fclose(in);
+    fclose(out);
+    if(frameAttemptHook != nullptr)
+      frameAttemptHook(compLvl, modSize, failed ? (size_t)-1 : dataSize, compSize, secondsSince(start));
+    if(failed) dataSize = 0;
+    if(failed || dataSize <= compSize)
+    {
+      if(srcHash != nullptr) *srcHash = hash.digest();
+      break;
+    }
   }
-  //else printf("compressed size: %lX\n", dataSize);
-  //FILE* f = fopen("/test","wb");
-  //fwrite(outBuff, 1, compSize, f);
-  delete[] inBuff;
-  return outBuff;
+  ZSTD_CCtx_reset(compContext, ZSTD_reset_session_and_parameters);
+  if(dataSize > compSize) dataSize = 0;
+  if(dataSize == 0) remove(compressTempPath);
+  timeCompressedFile(modSize, dataSize, compSize);
+  return dataSize;
 }
+
+// Writes paddingSize bytes of frame padding at the current position in arc
+void write_padding(u64 paddingSize, FILE* arc, xxhash64& hash) {
+    budgetBuffer zBuff(std::min(paddingSize, (u64)BUDGET_CHUNK_SIZE));
+    for (u64 done = 0; done < paddingSize; done += zBuff.size) {
+        u64 size = std::min(zBuff.size, paddingSize - done);
+        fillPadding(zBuff.data, done, size, paddingSize);
+        fwrite(zBuff.data, sizeof(char), size, arc);
+        hash.update(zBuff.data, size);
+    }
+}
+
+// Writes a frame from compressBuffer() so that it fills exactly compSize bytes at offset.
+// Returns the hash of what was written.
+u64 write_frame(const char* compBuf, u64 realCompSize, u64 compSize, u64 offset, FILE* arc) {
+    phaseTimer timer(PHASE_WRITE);
+    timer.bytes = compSize;
+    xxhash64 frameHash;
+    u64 headerSize = ZSTD_frameHeaderSize(compBuf, compSize);
+    fseek(arc, offset, SEEK_SET);
+    fwrite(compBuf, sizeof(char), headerSize, arc);
+    frameHash.update(compBuf, headerSize);
+    write_padding(compSize - realCompSize, arc, frameHash);
+    fwrite(compBuf+headerSize, sizeof(char), (realCompSize - headerSize), arc);
+    frameHash.update(compBuf+headerSize, realCompSize - headerSize);
+    return frameHash.digest();
+}
+
+// Same as write_frame() for a frame from compress_to_temp()
+u64 write_frame_from_file(const char* framePath, u64 realCompSize, u64 compSize, u64 offset, FILE* arc) {
+    phaseTimer timer(PHASE_WRITE);
+    timer.bytes = compSize;
+    xxhash64 frameHash;
+    FILE* f = fopen(framePath, "rb");
+    if (!f) return 0;
+    char header[ZSTD_FRAMEHEADERSIZE_MAX];
+    size_t headerRead = fread(header, sizeof(char), sizeof(header), f);
+    u64 headerSize = ZSTD_frameHeaderSize(header, headerRead);
+    fseek(arc, offset, SEEK_SET);
+    fwrite(header, sizeof(char), headerSize, arc);
+    frameHash.update(header, headerSize);
+    write_padding(compSize - realCompSize, arc, frameHash);
+    fseek(f, headerSize, SEEK_SET);
+    budgetBuffer buf(BUDGET_CHUNK_SIZE);
+    size_t size;
+    while ((size = fread(buf.data, sizeof(char), buf.size, f)) > 0) {
+        fwrite(buf.data, sizeof(char), size, arc);
+        frameHash.update(buf.data, size);
+    }
+    fclose(f);
+    return frameHash.digest();
+}
+
+// Copies a region of data.arc to a raw backup in chunks, for regions larger than the memory budget
+bool copy_region(FILE* arc, u64 offset, u64 size, FILE* out) {
+    auto start = std::chrono::steady_clock::now();
+    budgetBuffer buf(std::min(size, (u64)RESTORE_RUN_SIZE));
+    bool ret = true;
+    for (u64 done = 0; done < size && ret; done += buf.size) {
+        u64 chunk = std::min(buf.size, size - done);
+        fseek(arc, offset + done, SEEK_SET);
+        ret = fread(buf.data, sizeof(char), chunk, arc) == chunk;
+        ret = ret && fwrite(buf.data, sizeof(char), chunk, out) == chunk;
+    }
+    updateRate(sdWriteRate, size, secondsSince(start));
+    backupsStoredRaw++;
+    return ret;
+}
+
 // Forward declaration for use in minBackup()
 int load_mod(const char* path, uint64_t offset, FILE* arc);
 
-void minBackup(u64 modSize, u64 offset, FILE* arc) {
+// Puts a finished backup in place of path. The old backup, if any, is only removed once the
+// new one has its name, so a failure at any point leaves one complete backup.
+bool replace_backup(const char* tempPath, const char* path) {
+    if (!fileExists(std::string(path)))
+        return rename(tempPath, path) == 0;
+    std::string oldPath = std::string(path) + ".old";
+    remove(oldPath.c_str());
+    if (rename(path, oldPath.c_str()) != 0)
+        return false;
+    if (rename(tempPath, path) != 0) {
+        rename(oldPath.c_str(), path);
+        return false;
+    }
+    remove(oldPath.c_str());
+    return true;
+}
+
+// Puts back backups replace_backup() had moved aside when it was interrupted
+void restore_old_backups() {
+    std::error_code ec;
+    for (const auto& file : std::filesystem::directory_iterator(backups_root, ec)) {
+        std::string oldPath = file.path().string();
+        if (oldPath.size() < 4 || oldPath.compare(oldPath.size() - 4, 4, ".old") != 0)
+            continue;
+        std::string path = oldPath.substr(0, oldPath.size() - 4);
+        if (fileExists(path))
+            remove(oldPath.c_str());
+        else
+            rename(oldPath.c_str(), path.c_str());
+    }
+}
 
+// Backs up the modSize bytes at offset before a mod overwrites them. Returns 0 once a
+// complete backup is in place, the region must not be written otherwise.
+int minBackup(u64 modSize, u64 offset, FILE* arc) {
+    phaseTimer timer(PHASE_BACKUP);
     char* backup_path = new char[FILENAME_SIZE];
     snprintf(backup_path, FILENAME_SIZE, "%s0x%lx.backup", backups_root, offset);
 
     if (fileExists(std::string(backup_path))) {
-        if(modSize > std::experimental::filesystem::file_size(backup_path)) {
-            load_mod(backup_path, offset, arc);
-        }
-        else {
+        if(modSize <= backupRawSize(backup_path)) {
           printf(CONSOLE_BLUE "Backup file 0x%lx.backup already exists\n" CONSOLE_RESET, offset);
           delete[] backup_path;
-          return;
+          return 0;
+        }
+        // the larger backup is taken from vanilla data, so the smaller one is put back first
+        if(load_mod(backup_path, offset, arc) != 0) {
+          printf(CONSOLE_RED "Failed to restore '%s' before backing up a larger region\n" CONSOLE_RESET, backup_path);
+          delete[] backup_path;
+          return -1;
         }
     }
 
-    fseek(arc, offset, SEEK_SET);
-    char* buf = new char[modSize];
-    fread(buf, sizeof(char), modSize, arc);
-
-    FILE* backup = fopen(backup_path, "wb");
-    if (backup) fwrite(buf, sizeof(char), modSize, backup);
+    // Written under a temporary name first so an interrupted backup is never mistaken for a complete one
+    timer.bytes = modSize;
+    int ret = -1;
+    char* buf = budgetAlloc(modSize);
+    FILE* backup = fopen(backupTempPath, "wb");
+    if (backup) {
+        bool written;
+        if (buf != nullptr) {
+            fseek(arc, offset, SEEK_SET);
+            written = fread(buf, sizeof(char), modSize, arc) == modSize && writeBackup(buf, modSize, backup);
+        }
+        else written = copy_region(arc, offset, modSize, backup);  // stored raw, compressing needs the whole region
+        syncFile(backup);
+        written &= ferror(backup) == 0;
+        fclose(backup);
+        if (written && replace_backup(backupTempPath, backup_path))
+            ret = 0;
+        else {
+            remove(backupTempPath);
+            printf(CONSOLE_RED "Failed to write backup file '%s'\n" CONSOLE_RESET, backup_path);
+        }
+    }
     else printf(CONSOLE_RED "Attempted to create backup file '%s', failed to get backup file handle\n" CONSOLE_RESET, backup_path);
-    fclose(backup);
-    delete[] buf;
+    budgetFree(buf, modSize);
+    delete[] backup_path;
+    return ret;
+}
+
+// Whether a region may be overwritten, backing it up first in backup_mode=sd
+bool backed_up(u64 size, u64 offset, FILE* arc) {
+    if (backupMode != BACKUP_MODE_SD || minBackup(size, offset, arc) == 0)
+        return true;
+    journalSkip(offset, size);
+    printf(CONSOLE_RED "0x%lx was not written, it could not be backed up\n" CONSOLE_RESET, offset);
+    return false;
+}
+
+// Reads the unmodified compSize bytes of a region, from its backup, the vanilla arc,
+// or data.arc itself when no mod has been installed there.
+bool read_vanilla_file(u64 offset, u64 compSize, char* buf, FILE* arc) {
+    phaseTimer timer(PHASE_READ);
+    timer.bytes = compSize;
+    char* backup_path = new char[FILENAME_SIZE];
+    snprintf(backup_path, FILENAME_SIZE, "%s0x%lx.backup", backups_root, offset);
+    u64 backupSize = fileExists(std::string(backup_path)) ? backupRawSize(backup_path) : 0;
+    bool ret = false;
+    if(backupSize == compSize)
+        ret = readBackup(backup_path, buf, compSize);
+    else if(backupSize > compSize) {
+        char* backup = budgetAlloc(backupSize);
+        ret = backup != nullptr && readBackup(backup_path, backup, backupSize);
+        if(ret) memcpy(buf, backup, compSize);
+        budgetFree(backup, backupSize);
+    }
+    else if(backupMode == BACKUP_MODE_ROMFS)
+        ret = readVanillaRegion(offset, buf, compSize);
+    else if(manifest.find(offset) == nullptr) {
+        fseek(arc, offset, SEEK_SET);
+        ret = fread(buf, sizeof(char), compSize, arc) == compSize;
+    }
+    delete[] backup_path;
+    return ret;
+}
+
+// Whether the first size bytes at offset in data.arc still hash to hash
+bool region_matches(FILE* arc, u64 offset, u64 size, u64 hash) {
+    budgetBuffer buf(std::min(size, (u64)BUDGET_CHUNK_SIZE));
+    xxhash64 state;
+    bool ret = fseek(arc, offset, SEEK_SET) == 0;
+    for (u64 done = 0; done < size && ret; done += buf.size) {
+        u64 chunk = std::min(buf.size, size - done);
+        ret = fread(buf.data, sizeof(char), chunk, arc) == chunk;
+        state.update(buf.data, chunk);
+    }
+    return ret && state.digest() == hash;
+}
+
+// Whether data.arc still holds what the manifest recorded at offset. It does not after
+// data.arc was redumped or replaced, and the file has to be installed again.
+bool region_unchanged(FILE* arc, u64 offset, const manifestEntry& entry) {
+    phaseTimer timer(PHASE_VERIFY);
+    timer.bytes = entry.written;
+    return entry.written > 0 && region_matches(arc, offset, entry.written, entry.frameHash);
+}
+
+// Records a region written from a mod, once journalEnd() has flushed it.
+// written is the number of bytes installed.frameHash covers.
+void finishRegion(u64 offset, const manifestEntry& installed, u64 written) {
+    char* backup_path = new char[FILENAME_SIZE];
+    snprintf(backup_path, FILENAME_SIZE, "%s0x%lx.backup", backups_root, offset);
+    manifestEntry entry = installed;
+    entry.written = written;
+    manifest.set(offset, entry);
+    checkpointSet(offset, installed, written, fileExists(std::string(backup_path)));
     delete[] backup_path;
-    return;
+}
+
+// Records a region restored from its backup or the vanilla data.arc
+void finishRestore(u64 offset, u64 size) {
+    manifest.erase(offset, size);
+    checkpointErase(offset, size);
+}
+
+// Installs a mod file that is already in memory, compressing it to fit the region if needed.
+// compSize is 0 for files named by offset, which are written as is.
+int install_buffer(const char* data, u64 size, u64 offset, u64 compSize, u64 decompSize, FILE* arc, manifestEntry& installed) {
+    if(compSize == 0) compSize = decompSize = size;
+    if(size > decompSize) {
+        printf("Mod can not be larger than expected uncompressed size\n");
+        return -1;
+    }
+    char* compBuf = nullptr;
+    u64 realCompSize = 0;
+    if(compSize != decompSize && !ZSTD_isFrame(data, size)) {
+        printf("Compressing...\n");
+        refreshConsole();
+        compBuf = compressBuffer(data, size, compSize, realCompSize);
+        if(compBuf == nullptr) {
+            printf(CONSOLE_RED "Compression failed\n" CONSOLE_RESET);
+            return -1;
+        }
+    }
+
+    if(!backed_up(compSize, offset, arc)) {
+        budgetFree(compBuf, compSize+1);
+        return -1;
+    }
+    journalBegin(JOURNAL_INSTALL, offset, compSize);
+    u64 written = compSize;
+    if(compBuf != nullptr) {
+        installed.frameHash = write_frame(compBuf, realCompSize, compSize, offset, arc);
+        budgetFree(compBuf, compSize+1);
+        recordWritten(offset, compSize, installed.frameHash, true, size, verifyInstall ? xxhash64::hash(data, size) : 0, installed.source);
+    }
+    else {
+        phaseTimer timer(PHASE_WRITE);
+        timer.bytes = size;
+        fseek(arc, offset, SEEK_SET);
+        fwrite(data, sizeof(char), size, arc);
+        installed.frameHash = xxhash64::hash(data, size);
+        written = size;
+        recordWritten(offset, size, installed.frameHash, false, 0, 0, installed.source);
+    }
+    journalEnd(offset, arc);
+    installed.size = compSize;
+    finishRegion(offset, installed, written);
+    return 0;
+}
+
+// Rebuilds a file from its vanilla version and a .ummpatch, then installs it like a full file
+int load_patch(const char* path, const char* patch, u64 patchSize, u64 offset, FILE* arc, manifestEntry& installed) {
+    std::string pathStr(path);
+    loadOffsets();
+    if(offsetObj == nullptr) {
+        printf(CONSOLE_RED "Offsets.txt is needed to install patches\n" CONSOLE_RESET);
+        return -1;
+    }
+    std::string arcFile = patchTarget(pathStr.substr(pathStr.find('/',pathStr.find("mods/")+5)+1));
+    std::array<u64, 3> fileData = offsetObj->getKey(arcFile);
+    u64 compSize = fileData[1];
+    u64 decompSize = fileData[2];
+    if(compSize == 0) {
+        printf(CONSOLE_RED "%s not found in Offsets.txt\n" CONSOLE_RESET, arcFile.c_str());
+        return -1;
+    }
+
+    // the vanilla file, the patched file and its compressed frame are all held at once
+    if(!budgetFits(2 * compSize + 2 * decompSize)) {
+        printf(CONSOLE_RED "%s is too large to patch within the memory budget\n" CONSOLE_RESET, arcFile.c_str());
+        return -1;
+    }
+    char* region = budgetAlloc(compSize);
+    if(region == nullptr || !read_vanilla_file(offset, compSize, region, arc)) {
+        printf(CONSOLE_RED "No unmodified copy of %s to patch\n" CONSOLE_RESET, arcFile.c_str());
+        budgetFree(region, compSize);
+        return -1;
+    }
+    char* vanilla = region;
+    if(compSize != decompSize) {
+        vanilla = budgetAlloc(decompSize);
+        size_t size = vanilla != nullptr ? ZSTD_decompress(vanilla, decompSize, region, compSize) : 0;
+        budgetFree(region, compSize);
+        if(vanilla == nullptr || ZSTD_isError(size) || size != decompSize) {
+            printf(CONSOLE_RED "Could not decompress the vanilla %s\n" CONSOLE_RESET, arcFile.c_str());
+            budgetFree(vanilla, decompSize);
+            return -1;
+        }
+    }
+
+    installed.srcHash = xxhash64::hash(patch, patchSize);
+    std::vector<char> modFile;
+    bool patched = applyPatch(vanilla, decompSize, patch, patchSize, decompSize, modFile);
+    budgetFree(vanilla, decompSize);
+    if(!patched) {
+        printf(CONSOLE_RED "Patch does not apply to this version of %s\n" CONSOLE_RESET, arcFile.c_str());
+        return -1;
+    }
+    return install_buffer(modFile.data(), modFile.size(), offset, compSize, decompSize, arc, installed);
 }
 
 int load_mod(const char* path, uint64_t offset, FILE* arc) {
@@ -130,18 +596,73 @@ int load_mod(const char* path, uint64_t offset, FILE* arc) {
     u64 decompSize = 0;
     char* compBuf = nullptr;
     u64 realCompSize = 0;
+    bool streamed = false;
     std::string pathStr(path);
     u64 modSize = std::experimental::filesystem::file_size(path);
+    bool isBackup = pathStr.find(backups_root) != std::string::npos;
+    manifestEntry installed;
+    xxhash64 srcHash;
 
-    if(pathStr.substr(pathStr.find_last_of('/'), 3) != "/0x") {
-        if(offsetObj == nullptr && std::filesystem::exists(offsetDBPath)) {
-            printf("Parsing Offsets.txt\n");
-            consoleUpdate(NULL);
-            offsetObj = new offsetFile(offsetDBPath);
+    if(isBackup && isCompressedBackup(path)) {
+        u64 rawSize = backupRawSize(path);
+        journalBegin(JOURNAL_RESTORE, offset, rawSize);
+        int ret = restoreCompressedBackup(path, offset, arc);
+        if(ret == 0) {
+            journalEnd(offset, arc);
+            finishRestore(offset, rawSize);
+        }
+        return ret;
+    }
+
+    if(!isBackup) {
+        struct stat srcStat;
+        stat(path, &srcStat);
+        installed.source = pathStr;
+        installed.srcSize = modSize;
+        installed.srcMtime = srcStat.st_mtime;
+        const manifestEntry* current = manifest.find(offset);
+        if(current != nullptr && current->source == pathStr && current->srcSize == modSize &&
+           region_unchanged(arc, offset, *current)) {
+            if(current->srcMtime == installed.srcMtime) {
+                printf("Unchanged since last install\n");
+                return 0;
+            }
+            if(current->srcHash == hashFile(path)) {
+                manifest.touch(offset, installed.srcMtime);
+                printf("Unchanged since last install\n");
+                return 0;
+            }
+        }
+    }
+
+    if(isPatchFile(pathStr)) {
+        FILE* f = fopen(path, "rb");
+        if(!f) {
+            printf(CONSOLE_RED "Found file '%s', failed to get file handle\n" CONSOLE_RESET, path);
+            return -1;
+        }
+        char* patch = budgetAlloc(modSize);
+        if(patch == nullptr) {
+            fclose(f);
+            printf(CONSOLE_RED "Patch is larger than the memory budget\n" CONSOLE_RESET);
+            return -1;
+        }
+        {
+            phaseTimer timer(PHASE_READ);
+            timer.bytes = modSize;
+            fread(patch, sizeof(char), modSize, f);
+            fclose(f);
         }
+        int ret = load_patch(path, patch, modSize, offset, arc, installed);
+        budgetFree(patch, modSize);
+        return ret;
+    }
+
+    if(pathStr.substr(pathStr.find_last_of('/'), 3) != "/0x") {
+        loadOffsets();
         if(offsetObj != nullptr) {
             //printf("Looking up compression size in Offsets.txt\n");
-            //consoleUpdate(NULL);
+            //refreshConsole();
             std::string arcPath = pathStr.substr(pathStr.find('/',pathStr.find("mods/")+5)+1);
             fileData = offsetObj->getKey(arcPath);
             compSize = fileData[1];
@@ -153,9 +674,15 @@ int load_mod(const char* path, uint64_t offset, FILE* arc) {
             if(compSize != decompSize && !ZSTDFileIsFrame(path)) {
                 if(compSize != 0) {
                     printf("Compressing...\n");
-                    consoleUpdate(NULL);
-                    compBuf = compressFile(path, compSize, realCompSize);
-                    if (compBuf == nullptr)
+                    refreshConsole();
+                    if(budgetFits(modSize + compSize + 1))
+                        compBuf = compressFile(path, compSize, realCompSize, &installed.srcHash);
+                    else {
+                        // too large for the memory budget, compressed through a file on the SD card instead
+                        realCompSize = compress_to_temp(path, modSize, compSize, &installed.srcHash);
+                        streamed = realCompSize != 0;
+                    }
+                    if (compBuf == nullptr && !streamed)
                     {
                         printf(CONSOLE_RED "Compression failed\n" CONSOLE_RESET);
                         return -1;
@@ -168,28 +695,26 @@ int load_mod(const char* path, uint64_t offset, FILE* arc) {
         }
     }
     if(pathStr.find(backups_root) == std::string::npos) {
-        if(compSize > 0) minBackup(compSize, offset, arc);
-        else minBackup(modSize, offset, arc);
+        if(!backed_up(compSize > 0 ? compSize : modSize, offset, arc)) {
+            budgetFree(compBuf, compSize+1);
+            if(streamed) remove(compressTempPath);
+            return -1;
+        }
+        journalBegin(JOURNAL_INSTALL, offset, compSize > 0 ? compSize : modSize);
     }
-    if(compBuf != nullptr) {
-        u64 headerSize = ZSTD_frameHeaderSize(compBuf, compSize);
-        //u64 frameSize = ZSTD_findFrameCompressedSize(compBuf, compSize);
-        u64 paddingSize = (compSize - realCompSize);
-        fseek(arc, offset, SEEK_SET);
-        fwrite(compBuf, sizeof(char), headerSize, arc);
-        char* zBuff = new char[paddingSize];
-        memset(zBuff, 0, paddingSize);
-        if (paddingSize % 3 != 0) {
-            if (paddingSize % 3 == 1) zBuff[paddingSize-4] = 2;
-            else if (paddingSize % 3 == 2) {
-                zBuff[paddingSize-4] = 2;
-                zBuff[paddingSize-8] = 2;
-            }
+    else journalBegin(JOURNAL_RESTORE, offset, modSize);
+    installed.size = compSize > 0 ? compSize : modSize;
+    u64 written = installed.size;
+    if(compBuf != nullptr || streamed) {
+        if(streamed) {
+            installed.frameHash = write_frame_from_file(compressTempPath, realCompSize, compSize, offset, arc);
+            remove(compressTempPath);
         }
-        fwrite(zBuff, sizeof(char), paddingSize, arc);
-        delete[] zBuff;
-        fwrite(compBuf+headerSize, sizeof(char), (realCompSize - headerSize), arc);
-        delete[] compBuf;
+        else {
+            installed.frameHash = write_frame(compBuf, realCompSize, compSize, offset, arc);
+            budgetFree(compBuf, compSize+1);
+        }
+        recordWritten(offset, compSize, installed.frameHash, true, modSize, installed.srcHash, pathStr);
     }
     else{
         FILE* f = fopen(path, "rb");
@@ -202,13 +727,23 @@ int load_mod(const char* path, uint64_t offset, FILE* arc) {
                 // Copy in up to FILE_READ_SIZE byte chunks
                 size_t size;
                 do {
-                    size = fread(copy_buffer, 1, FILE_READ_SIZE, f);
+                    {
+                        phaseTimer timer(PHASE_READ);
+                        size = fread(copy_buffer, 1, FILE_READ_SIZE, f);
+                        timer.bytes = size;
+                    }
                     total_size += size;
+                    srcHash.update(copy_buffer, size);
 
+                    phaseTimer timer(PHASE_WRITE);
+                    timer.bytes = size;
                     fwrite(copy_buffer, 1, size, arc);
                 } while(size == FILE_READ_SIZE);
 
                 free(copy_buffer);
+                installed.srcHash = installed.frameHash = srcHash.digest();
+                written = total_size;
+                recordWritten(offset, total_size, installed.frameHash, false, 0, 0, pathStr);
             }
 
             fclose(f);
@@ -218,8 +753,118 @@ int load_mod(const char* path, uint64_t offset, FILE* arc) {
         }
     }
 
+    journalEnd(offset, arc);
+    if(isBackup) finishRestore(offset, modSize);
+    else finishRegion(offset, installed, written);
+    return 0;
+}
+// Installs one file of a .zip or .tar mod, read straight from the archive
+int load_archive_entry(const modTarget& target, FILE* arc) {
+    const archiveEntry& entry = *target.entry;
+    manifestEntry installed;
+    installed.source = target.filePath;
+    installed.srcSize = entry.size;
+    installed.srcMtime = target.archive->mtime;
+    const manifestEntry* current = manifest.find(target.offset);
+    bool sameFile = current != nullptr && current->source == installed.source && current->srcSize == entry.size &&
+                    region_unchanged(arc, target.offset, *current);
+    if(sameFile && current->srcMtime == installed.srcMtime) {
+        printf("Unchanged since last install\n");
+        return 0;
+    }
+
+    // entries are decompressed and compressed in memory, there is no streaming fallback
+    char* data = budgetFits(entry.size + target.size + 1) ? budgetAlloc(entry.size) : nullptr;
+    if(data == nullptr) {
+        printf(CONSOLE_RED "'%s' is too large for the memory budget, extract %s to install it\n" CONSOLE_RESET,
+               entry.name.c_str(), target.archive->path.c_str());
+        return -1;
+    }
+    bool read;
+    {
+        phaseTimer timer(PHASE_READ);
+        timer.bytes = entry.size;
+        read = target.archive->read(entry, data);
+    }
+    if(!read) {
+        printf(CONSOLE_RED "Failed to read '%s' from %s\n" CONSOLE_RESET, entry.name.c_str(), target.archive->path.c_str());
+        budgetFree(data, entry.size);
+        return -1;
+    }
+    installed.srcHash = xxhash64::hash(data, entry.size);
+    int ret = 0;
+    if(sameFile && current->srcHash == installed.srcHash) {
+        manifest.touch(target.offset, installed.srcMtime);
+        printf("Unchanged since last install\n");
+    }
+    else if(isPatchFile(target.arcPath))
+        ret = load_patch(target.filePath.c_str(), data, entry.size, target.offset, arc, installed);
+    else
+        ret = install_buffer(data, entry.size, target.offset, target.decompSize != 0 ? target.size : 0, target.decompSize, arc, installed);
+    budgetFree(data, entry.size);
+    return ret;
+}
+
+// Writes one entry of a .umm package. The payload already fills its region exactly.
+int load_package_entry(const modTarget& target, FILE* arc) {
+    const ummEntry& entry = *target.packed;
+    const manifestEntry* current = manifest.find(target.offset);
+    if(current != nullptr && current->source == target.filePath && current->frameHash == entry.hash &&
+       region_unchanged(arc, target.offset, *current)) {
+        printf("Unchanged since last install\n");
+        return 0;
+    }
+    // payloads larger than the memory budget are checked in one pass and copied in a second
+    char* data = budgetAlloc(entry.compSize);
+    budgetBuffer chunk(data == nullptr ? BUDGET_CHUNK_SIZE : 0);
+    bool intact;
+    {
+        phaseTimer timer(PHASE_READ);
+        timer.bytes = entry.compSize;
+        intact = data != nullptr ? target.package->read(entry, data) : target.package->stream(entry, nullptr, chunk.data, chunk.size);
+    }
+    if(!intact) {
+        printf(CONSOLE_RED "'%s' is damaged in %s\n" CONSOLE_RESET, target.arcPath.c_str(), target.package->path.c_str());
+        budgetFree(data, entry.compSize);
+        return -1;
+    }
+    if(!backed_up(entry.compSize, target.offset, arc)) {
+        budgetFree(data, entry.compSize);
+        return -1;
+    }
+    journalBegin(JOURNAL_INSTALL, target.offset, entry.compSize);
+    {
+        phaseTimer timer(PHASE_WRITE);
+        timer.bytes = entry.compSize;
+        fseek(arc, target.offset, SEEK_SET);
+        if(data != nullptr)
+            fwrite(data, sizeof(char), entry.compSize, arc);
+        else
+            target.package->stream(entry, arc, chunk.data, chunk.size);
+    }
+    journalEnd(target.offset, arc);
+    bool compressed = entry.compSize != entry.decompSize && target.package->isFrame(entry);
+    recordWritten(target.offset, entry.compSize, entry.hash, compressed, entry.decompSize, 0, target.filePath);
+    budgetFree(data, entry.compSize);
+
+    manifestEntry installed;
+    installed.size = entry.compSize;
+    installed.source = target.filePath;
+    installed.srcSize = entry.compSize;
+    installed.srcMtime = target.package->mtime;
+    installed.srcHash = installed.frameHash = entry.hash;
+    finishRegion(target.offset, installed, entry.compSize);
     return 0;
 }
+
+int load_target(const modTarget& target, FILE* arc) {
+    if(target.package != nullptr)
+        return load_package_entry(target, arc);
+    if(target.archive != nullptr)
+        return load_archive_entry(target, arc);
+    return load_mod(target.filePath.c_str(), target.offset, arc);
+}
+
 /*
 int create_backup(const char* mod_dir, char* filename, uint64_t offset, FILE* arc) {  // Not used
     char* backup_path = (char*) malloc(FILENAME_SIZE);
@@ -277,135 +922,744 @@ int create_backup(const char* mod_dir, char* filename, uint64_t offset, FILE* ar
 }
 */
 
-#define UC(c) ((unsigned char)c)
+void queue_restore(const std::string& backup_path, u64 offset) {
+    pendingRestores.push_back({offset, backupRawSize(backup_path.c_str()), backup_path, false});
+}
 
-char _isxdigit (unsigned char c)
-{
-    if (( c >= UC('0') && c <= UC('9') ) ||
-        ( c >= UC('a') && c <= UC('f') ) ||
-        ( c >= UC('A') && c <= UC('F') ))
-        return 1;
-    return 0;
+// Restores from the vanilla data.arc instead of a backup file
+void queue_vanilla_restore(u64 offset, u64 size) {
+    pendingRestores.push_back({offset, size, "", false});
 }
 
-unsigned char xtoc(char x) {
-    if (x >= UC('0') && x <= UC('9'))
-        return x - UC('0');
-    else if (x >= UC('a') && x <= UC('f'))
-        return (x - UC('a')) + 0xa;
-    else if (x >= UC('A') && x <= UC('F'))
-        return (x - UC('A')) + 0xA;
-    return -1;
+bool read_restore_source(const pendingRestore& p, char* buf) {
+    if (p.path.empty())
+        return readVanillaRegion(p.offset, buf, p.size);
+    return readBackup(p.path.c_str(), buf, p.size);
 }
 
-uint64_t hex_to_u64(char* str) {
-    uint64_t value = 0;
-    if(str[0] == '0' && str[1] == 'x') {
-        str += 2;
-        while(_isxdigit(*str)) {
-            value *= 0x10;
-            value += xtoc(*str);
-            str++;
+// Restores a region too large for one run from the vanilla data.arc, in chunks
+int restore_vanilla_region(u64 offset, u64 size, FILE* arc) {
+    budgetBuffer buf(std::min(size, (u64)RESTORE_RUN_SIZE));
+    int ret = 0;
+    journalBegin(JOURNAL_RESTORE, offset, size);
+    for (u64 done = 0; done < size; done += buf.size) {
+        u64 chunk = std::min(buf.size, size - done);
+        if (!readVanillaRegion(offset + done, buf.data, chunk)) {
+            ret = -1;
+            break;
         }
+        fseek(arc, offset + done, SEEK_SET);
+        fwrite(buf.data, sizeof(char), chunk, arc);
+    }
+    if (ret == 0) {
+        journalEnd(offset, arc);
+        finishRestore(offset, size);
     }
-    return value;
+    return ret;
+}
+
+int restore_single(const pendingRestore& p, FILE* arc) {
+    if (p.path.empty())
+        return restore_vanilla_region(p.offset, p.size, arc);
+    return load_mod(p.path.c_str(), p.offset, arc);
 }
 
-void add_mod_dir(const char* path) {
-    mod_dirs = (char**) realloc(mod_dirs, ++num_mod_dirs * sizeof(const char*));
-    mod_dirs[num_mod_dirs-1] = (char*) malloc(FILENAME_SIZE * sizeof(char));
-    strcpy(mod_dirs[num_mod_dirs-1], path);
+void restore_run(FILE* arc, pendingRestore* first, pendingRestore* last, char* runBuf) {
+    u64 runStart = first->offset;
+    u64 runEnd = runStart;
+    for (pendingRestore* p = first; p != last; p++) {
+        if (!read_restore_source(*p, runBuf + (p->offset - runStart))) {
+            // fall back to restoring this run one region at a time
+            for (pendingRestore* q = first; q != last; q++)
+                q->restored = restore_single(*q, arc) == 0;
+            return;
+        }
+        runEnd = std::max(runEnd, p->offset + p->size);
+    }
+    for (const pendingRestore* p = first; p != last; p++)
+        journalBegin(JOURNAL_RESTORE, p->offset, p->size);
+    fseek(arc, runStart, SEEK_SET);
+    fwrite(runBuf, sizeof(char), runEnd - runStart, arc);
+    for (pendingRestore* p = first; p != last; p++) {
+        journalEnd(p->offset, arc);
+        finishRestore(p->offset, p->size);
+        p->restored = true;
+    }
 }
 
-void remove_last_mod_dir() {
-    free(mod_dirs[num_mod_dirs-1]);
-    num_mod_dirs--;
+// Writes every queued backup back in offset order, merging adjacent regions into single writes,
+// then deletes the backups.
+void bulk_restore(FILE* arc) {
+    if (pendingRestores.empty())
+        return;
+    // stable, so a backup file queued before a vanilla restore of the same region is the one kept
+    std::stable_sort(pendingRestores.begin(), pendingRestores.end(), [](const pendingRestore& a, const pendingRestore& b) {
+        return a.offset < b.offset;
+    });
+    pendingRestores.erase(std::unique(pendingRestores.begin(), pendingRestores.end(), [](const pendingRestore& a, const pendingRestore& b) {
+        return a.offset == b.offset;
+    }), pendingRestores.end());
+
+    printf("Restoring %lu backup(s)...\n", pendingRestores.size());
+    refreshConsole();
+    phaseTimer timer(PHASE_RESTORE);
+    auto start = std::chrono::steady_clock::now();
+    budgetBuffer runBuffer(RESTORE_RUN_SIZE);
+    char* runBuf = runBuffer.data;
+    u64 runSize = runBuffer.size;
+    u64 bytes = 0, writes = 0;
+    size_t i = 0;
+    bool cancelled = false;
+    while (i < pendingRestores.size()) {
+        if (installCancelled()) {
+            cancelled = true;
+            break;
+        }
+        reportProgress("Restoring", i, pendingRestores.size(), bytes);
+        pendingRestore& first = pendingRestores[i];
+        if (first.size > runSize) {
+            first.restored = restore_single(first, arc) == 0;
+            bytes += first.size;
+            writes++;
+            i++;
+            continue;
+        }
+        u64 runEnd = first.offset + first.size;
+        size_t j = i + 1;
+        while (j < pendingRestores.size() && pendingRestores[j].offset <= runEnd &&
+               std::max(runEnd, pendingRestores[j].offset + pendingRestores[j].size) - first.offset <= runSize) {
+            runEnd = std::max(runEnd, pendingRestores[j].offset + pendingRestores[j].size);
+            j++;
+        }
+        restore_run(arc, &pendingRestores[i], &pendingRestores[0] + j, runBuf);
+        bytes += runEnd - first.offset;
+        writes++;
+        i = j;
+    }
+    timer.bytes = bytes;
+
+    bool allRestored = std::all_of(pendingRestores.begin(), pendingRestores.end(), [](const pendingRestore& p) { return p.restored; });
+    if (restoreAllBackups && allRestored) {
+        fsdevDeleteDirectoryRecursively(backups_root);
+        mkdir(backups_root, 0777);
+    }
+    else {
+        for (const pendingRestore& p : pendingRestores) {
+            if (p.restored) {
+                if (!p.path.empty()) remove(p.path.c_str());
+            }
+            else if (!cancelled)
+                printf(CONSOLE_RED "Failed to restore 0x%lx, its backup was kept\n" CONSOLE_RESET, p.offset);
+        }
+        if (cancelled)
+            printf(CONSOLE_YELLOW "Cancelled, %lu region(s) were not restored and keep their backups\n" CONSOLE_RESET,
+                   pendingRestores.size() - i);
+    }
+    double seconds = secondsSince(start);
+    printf(CONSOLE_BLUE "Restored %lu region(s) in %lu write(s), %.1f MiB/s\n\n" CONSOLE_RESET, pendingRestores.size(), writes,
+           seconds > 0 ? bytes / seconds / 0x100000 : 0);
+    pendingRestores.clear();
+    restoreAllBackups = false;
+    closeVanillaArc();
 }
 
-int load_mods(FILE* f_arc) {
-    std::string mod_dir = mod_dirs[num_mod_dirs-1];
+// Queues the region a mod file was installed to for restoring
+void uninstall_file(const std::string& mod_file, u64 offset) {
+    char* backup_path = (char*) malloc(FILENAME_SIZE);
+    snprintf(backup_path, FILENAME_SIZE, "%s0x%lx.backup", backups_root, offset);
 
-    remove_last_mod_dir();
+    const manifestEntry* current = manifest.find(offset);
+    if(current != nullptr && current->source != mod_file) {
+        printf(CONSOLE_YELLOW "%s is now provided by %s, not restored\n\n" CONSOLE_RESET,
+               mod_file.c_str(), current->source.c_str());
+    }
+    else if(std::filesystem::exists(backup_path)) {
+        queue_restore(backup_path, offset);
+        printf(CONSOLE_BLUE "%s\n\n" CONSOLE_RESET, mod_file.c_str());
+    }
+    else if(current != nullptr && backupMode == BACKUP_MODE_ROMFS) {
+        queue_vanilla_restore(offset, current->size);
+        printf(CONSOLE_BLUE "%s\n\n" CONSOLE_RESET, mod_file.c_str());
+    }
+    else printf(CONSOLE_RED "No backup found\n\n" CONSOLE_RESET);
+    free(backup_path);
+}
+
+int load_mods(FILE* f_arc, const std::string& mod_dir) {
+    if (mod_dir == "backups")
+        restoreAllRegions = true;
 
-    DIR *d;
-    struct dirent *dir;
+    if (isPackedMod(mod_dir)) {
+        // archives and packages are only walked here to uninstall, installs go through install_resolved()
+        printf("Searching mod file " CONSOLE_YELLOW "%s\n\n" CONSOLE_RESET, mod_dir.c_str());
+        loadOffsets();
+        for (const modTarget& target : getModTargets(manager_root, mod_dir, offsetObj))
+            uninstall_file(target.filePath, target.offset);
+        return 0;
+    }
 
     printf("Searching mod dir " CONSOLE_YELLOW "%s\n\n" CONSOLE_RESET, mod_dir.c_str());
-    consoleUpdate(NULL);
+    refreshConsole();
 
     std::string abs_mod_dir = std::string(manager_root) + mod_dir;
-    d = opendir(abs_mod_dir.c_str());
-    if (d)
+    modScan scan;
+    bool opened;
     {
-        while ((dir = readdir(d)) != NULL)
-        {
-            if(dir->d_type == DT_DIR) {
-                if (strcmp(dir->d_name, ".") == 0 || strcmp(dir->d_name, "..") == 0)
-                    continue;
-                std::string new_mod_dir = mod_dir + "/" + dir->d_name;
-                add_mod_dir(new_mod_dir.c_str());
+        phaseTimer timer(PHASE_SCAN);
+        opened = scan.scan(abs_mod_dir);
+    }
+    if (!opened) {
+        printf(CONSOLE_RED "Failed to open mod directory '%s'\n" CONSOLE_RESET, abs_mod_dir.c_str());
+        refreshConsole();
+        return 0;
+    }
+    countScan(scan);
+    printScanTime();
+
+    for (const scannedFile& file : scan.files) {
+        if (installCancelled())
+            break;
+        uint64_t offset = hex_to_u64(file.name);
+        if(!offset) {
+            loadOffsets();
+            phaseTimer timer(PHASE_LOOKUP);
+            if(offsetObj != nullptr)
+                offset = offsetObj->getOffset(patchTarget(file.path));
+        }
+        if(offset){
+            if (mod_dir == "backups") {
+                std::string backup_file = std::string(backups_root) + file.path;
+                queue_restore(backup_file, offset);
+                restoreAllBackups = true;
             } else {
-                uint64_t offset = hex_to_u64(dir->d_name);
-                if(!offset) {
-                    if(offsetObj == nullptr && std::filesystem::exists(offsetDBPath)) {
-                        printf("Parsing Offsets.txt\n");
-                        consoleUpdate(NULL);
-                        offsetObj = new offsetFile(offsetDBPath);
-                    }
-                    if(offsetObj != nullptr) {
-                        //printf("Trying to find offset in Offsets.txt\n");
-                        //consoleUpdate(NULL);
-                        std::string arcFileName = (mod_dir.substr(mod_dir.find('/', mod_dir.find('/')+1) + 1) + "/" + dir->d_name);
-                        offset = offsetObj->getOffset(arcFileName);
-                    }
-                }
-                if(offset){
-                    if (mod_dir == "backups") {
-                        std::string backup_file = std::string(backups_root) + std::string(dir->d_name);
-                        load_mod(backup_file.c_str(), offset, f_arc);
-
-                        remove(backup_file.c_str());
-                        printf(CONSOLE_BLUE "%s\n\n" CONSOLE_RESET, dir->d_name);
-                        consoleUpdate(NULL);
-                    } else {
-                        std::string mod_file = std::string(manager_root) + mod_dir + "/" + dir->d_name;
-                        if (installing == INSTALL) {
-                            appletSetCpuBoostMode(ApmCpuBoostMode_Type1);
-                            load_mod(mod_file.c_str(), offset, f_arc);
-                            appletSetCpuBoostMode(ApmCpuBoostMode_Disabled);
-                            printf(CONSOLE_GREEN "%s/%s\n\n" CONSOLE_RESET, mod_dir.c_str(), dir->d_name);
-                            consoleUpdate(NULL);
-                        } else if (installing == UNINSTALL) {
-                            char* backup_path = (char*) malloc(FILENAME_SIZE);
-                            snprintf(backup_path, FILENAME_SIZE, "%s0x%lx.backup", backups_root, offset);
-
-                            if(std::filesystem::exists(backup_path)) {
-                                load_mod(backup_path, offset, f_arc);
-                                remove(backup_path);
-                                printf(CONSOLE_BLUE "%s\n\n" CONSOLE_RESET, mod_file.c_str());
-                            }
-                            else printf(CONSOLE_RED "No backup found\n\n" CONSOLE_RESET);
-                            free(backup_path);
-                        }
-                    }
-                } else {
-                    printf(CONSOLE_RED "Found file '%s', offset not parsable\n" CONSOLE_RESET, dir->d_name);
-                    consoleUpdate(NULL);
+                std::string mod_file = abs_mod_dir + "/" + file.path;
+                if (installing == INSTALL) {
+                    fileTimer timer(mod_file, offset, 0);
+                    appletSetCpuBoostMode(ApmCpuBoostMode_Type1);
+                    load_mod(mod_file.c_str(), offset, f_arc);
+                    appletSetCpuBoostMode(ApmCpuBoostMode_Disabled);
+                    printf(CONSOLE_GREEN "%s/%s\n\n" CONSOLE_RESET, mod_dir.c_str(), file.path);
+                    refreshConsole();
+                } else if (installing == UNINSTALL) {
+                    uninstall_file(mod_file, offset);
                 }
             }
+        } else {
+            printf(CONSOLE_RED "Found file '%s', offset not parsable\n" CONSOLE_RESET, file.path);
+            refreshConsole();
         }
-        closedir(d);
-    } else {
-        printf(CONSOLE_RED "Failed to open mod directory '%s'\n" CONSOLE_RESET, abs_mod_dir.c_str());
-        consoleUpdate(NULL);
     }
 
     return 0;
 }
 
+std::string arcPath() {
+    return "sdmc:/" + getCFW() + "/titles/01006A800016E000/romfs/data.arc";
+}
+
+// backup_mode=romfs is only kept when vanillaArcPath can be trusted to be unmodified, otherwise
+// mods are backed up to the SD card and nothing is restored from the vanilla data.arc
+void checkVanillaSource(FILE* arc) {
+    if (backupMode != BACKUP_MODE_ROMFS)
+        return;
+    manifest.load();
+    std::vector<std::pair<u64, u64>> written;
+    for (auto& [offset, entry] : manifest.regions) {
+        if (entry.written > 0)
+            written.push_back({offset, entry.written});
+    }
+    std::string problem = vanillaArcProblem(arcPath(), arc, written);
+    if (problem.empty())
+        return;
+    printf(CONSOLE_YELLOW "Not using %s as the vanilla data.arc, %s.\nSet vanilla_arc to an unmodified copy to install without backups.\n\n" CONSOLE_RESET,
+           vanillaArcPath.c_str(), problem.c_str());
+    closeVanillaArc();
+    backupMode = BACKUP_MODE_SD;
+}
+
+// Carries the regions an interrupted install finished over to the manifest, so running the
+// same install again skips them as unchanged. A region is only kept if it reads back with
+// the hash it was written with and its backup, if it had one, is still there.
+void resume_checkpoint(FILE* arc) {
+    std::vector<checkpointRecord> records = checkpointRecords();
+    if(records.empty())
+        return;
+    manifest.load();
+    char* backup_path = new char[FILENAME_SIZE];
+    size_t kept = 0, dropped = 0;
+    for(const checkpointRecord& record : records) {
+        if(record.type == CHECKPOINT_ERASE) {
+            manifest.erase(record.offset, record.entry.size);
+            continue;
+        }
+        snprintf(backup_path, FILENAME_SIZE, "%s0x%lx.backup", backups_root, record.offset);
+        if(record.backup && !fileExists(std::string(backup_path))) {
+            printf(CONSOLE_RED "Backup of 0x%lx is missing, %s will be installed again\n" CONSOLE_RESET,
+                   record.offset, record.entry.source.c_str());
+            manifest.erase(record.offset, record.entry.size);
+            dropped++;
+        }
+        else if(region_matches(arc, record.offset, record.written, record.entry.frameHash)) {
+            manifest.set(record.offset, record.entry);
+            kept++;
+        }
+        else {
+            manifest.erase(record.offset, record.entry.size);
+            dropped++;
+        }
+    }
+    delete[] backup_path;
+    if(kept + dropped == 0)
+        return;
+    printf(CONSOLE_BLUE "Kept %lu region(s) the interrupted installation finished" CONSOLE_RESET, kept);
+    if(dropped > 0) printf(", %lu will be written again", dropped);
+    printf("\nInstall the same mods again to continue where it stopped\n");
+}
+
+// Replays or rolls back region writes that a crash or power loss interrupted.
+// Both cases are handled by writing the region's backup back over it.
+// Regions the install finished are kept, see resume_checkpoint().
+// Returns true if anything had to be recovered.
+bool recoverInterruptedInstall() {
+    if(!std::filesystem::exists(journalPath) && !std::filesystem::exists(checkpointPath))
+        return false;
+    std::map<u64, journalRecord> pending = journalPending();
+    bool resumable = !checkpointRecords().empty();
+    remove(backupTempPath);
+    restore_old_backups();
+    if(pending.empty() && !resumable) {
+        remove(journalPath);
+        remove(checkpointPath);
+        return false;
+    }
+    if(!pending.empty())
+        printf(CONSOLE_YELLOW "Recovering %lu region(s) from an interrupted installation\n" CONSOLE_RESET, pending.size());
+    refreshConsole();
+    FILE* f_arc = fopen(arcPath().c_str(), "r+b");
+    if(!f_arc) {
+        printf(CONSOLE_RED "Failed to get file handle to data.arc\n" CONSOLE_RESET);
+        return true;
+    }
+    loadConfig();
+    resume_checkpoint(f_arc);
+    checkVanillaSource(f_arc);
+    journalOpen();
+    char* backup_path = new char[FILENAME_SIZE];
+    for(auto& [offset, record] : pending) {
+        snprintf(backup_path, FILENAME_SIZE, "%s0x%lx.backup", backups_root, offset);
+        if(fileExists(std::string(backup_path))) {
+            load_mod(backup_path, offset, f_arc);
+            if(record.type == JOURNAL_RESTORE) remove(backup_path);
+            printf(CONSOLE_BLUE "Restored 0x%lx\n" CONSOLE_RESET, offset);
+        }
+        else if(backupMode == BACKUP_MODE_ROMFS && restore_vanilla_region(offset, record.size, f_arc) == 0)
+            printf(CONSOLE_BLUE "Restored 0x%lx from %s\n" CONSOLE_RESET, offset, vanillaArcPath.c_str());
+        else printf(CONSOLE_RED "No backup for 0x%lx, reinstall the mod or redump data.arc\n" CONSOLE_RESET, offset);
+    }
+    delete[] backup_path;
+    closeVanillaArc();
+    fclose(f_arc);
+    journalClose();
+    checkpointClose(manifest.save());
+    printf("\n");
+    return true;
+}
+
+// Selected mod folders, highest priority first
+std::vector<std::string> selectedByPriority() {
+    std::vector<std::string> mods;
+    for (const std::string& mod_dir : mod_dirs) {
+        if (mod_dir != "backups")
+            mods.push_back(mod_dir.substr(strlen("mods/")));
+    }
+    sortByPriority(mods, loadPriority());
+    for (std::string& mod : mods)
+        mod = "mods/" + mod;
+    return mods;
+}
+
+// Selected mod folders in write order, lowest priority first so that the mods ranked
+// higher in priority.txt, then alphabetically, are written last and win any overlap
+std::vector<std::string> installOrder() {
+    std::vector<std::string> order = selectedByPriority();
+    std::reverse(order.begin(), order.end());
+    return order;
+}
+
+void printConflicts(const std::vector<targetConflict>& conflicts, size_t maxShown) {
+    for (size_t i = 0; i < conflicts.size() && i < maxShown; i++) {
+        const targetConflict& conflict = conflicts[i];
+        printf(CONSOLE_YELLOW "0x%lx-0x%lx" CONSOLE_RESET " %s\n", conflict.offset, conflict.end,
+               conflict.writers.back().second->arcPath.c_str());
+        for (size_t j = 0; j < conflict.writers.size(); j++) {
+            printf("  %lu. %s/%s%s\n", j+1, conflict.writers[j].first.c_str(), conflict.writers[j].second->arcPath.c_str(),
+                   j+1 == conflict.writers.size() ? CONSOLE_GREEN " (wins)" CONSOLE_RESET : "");
+        }
+    }
+    if (conflicts.size() > maxShown)
+        printf("...and %lu more\n", conflicts.size() - maxShown);
+}
+
+void reportConflicts() {
+    std::vector<std::string> order = installOrder();
+    if (installing != INSTALL || order.size() < 2)
+        return;
+    loadOffsets();
+    auto start = std::chrono::steady_clock::now();
+    std::vector<targetConflict> conflicts = findConflicts(manager_root, order, offsetObj);
+    if (conflicts.empty())
+        return;
+    printf(CONSOLE_YELLOW "%lu overlapping region(s) between selected mods" CONSOLE_RESET " (checked in %.1f ms):\n",
+           conflicts.size(), secondsSince(start) * 1000);
+    printConflicts(conflicts, 10);
+    printf("\n");
+    refreshConsole();
+}
+
+bool is_unchanged(const modTarget& target) {
+    const manifestEntry* current = manifest.find(target.offset);
+    if (current == nullptr || current->source != target.filePath)
+        return false;
+    if (target.package != nullptr)
+        return current->frameHash == target.packed->hash;
+    if (target.archive != nullptr)
+        return current->srcSize == target.entry->size && current->srcMtime == target.archive->mtime;
+    struct stat st;
+    return stat(target.filePath.c_str(), &st) == 0 && current->srcSize == (u64)st.st_size && current->srcMtime == (u64)st.st_mtime;
+}
+
+// Predicts the cost of writing one target and adds it to estimate. With vanilla set the
+// estimate ignores what is already installed and backed up, as the mod index does.
+void estimateTarget(const modTarget& target, ZSTD_CCtx* cctx, installEstimate& estimate, bool vanilla) {
+    fileEstimate file;
+    file.path = target.filePath;
+    file.offset = target.offset;
+    file.regionSize = target.size;
+    file.predictedSize = 0;
+    file.seconds = 0;
+    file.action = "copy";
+    struct stat st;
+    if (target.package != nullptr)
+        file.modSize = target.packed->compSize;
+    else if (target.archive != nullptr)
+        file.modSize = target.entry->size;
+    else if (stat(target.filePath.c_str(), &st) == 0)
+        file.modSize = st.st_size;
+    else {
+        file.modSize = 0;
+        file.problem = "could not be read";
+    }
+
+    if (!file.problem.empty())
+        ;  // reported as a failure by addEstimate()
+    else if (!vanilla && is_unchanged(target))
+        file.action = "unchanged";
+    else if (target.package != nullptr)
+        file.action = "copy";  // already compressed when the package was built
+    else if (isPatchFile(file.path)) {
+        // the patched file's size is only known once applied, assume it compresses like the vanilla one
+        file.action = "patch";
+        file.predictedSize = target.size;
+    }
+    else if (target.decompSize != 0) {
+        if (file.modSize > target.decompSize)
+            file.problem = "larger than expected uncompressed size";
+        else if (target.size != target.decompSize && target.archive != nullptr) {
+            char* data = budgetAlloc(file.modSize);
+            double secondsPerByte;
+            if (data == nullptr)
+                file.problem = "larger than the memory budget";
+            else if (!target.archive->read(*target.entry, data))
+                file.problem = "could not be read from the archive";
+            else if (!ZSTD_isFrame(data, file.modSize)) {
+                double ratio = sampleBuffer(cctx, data, file.modSize, secondsPerByte);
+                predictCompression(file, target.size, ratio, secondsPerByte);
+            }
+            budgetFree(data, file.modSize);
+        }
+        else if (target.size != target.decompSize && !ZSTDFileIsFrame(file.path.c_str())) {
+            double secondsPerByte;
+            double ratio = sampleCompression(cctx, file.path.c_str(), file.modSize, secondsPerByte);
+            predictCompression(file, target.size, ratio, secondsPerByte);
+        }
+    }
+    char backup_path[FILENAME_SIZE];
+    snprintf(backup_path, FILENAME_SIZE, "%s0x%lx.backup", backups_root, target.offset);
+    u64 backupSize = (backupMode == BACKUP_MODE_ROMFS || (!vanilla && fileExists(std::string(backup_path)))) ? 0 : target.size;
+    addEstimate(estimate, file, backupSize, sdWriteRate);
+}
+
+// Predicts the cost of installing the selected mods without touching data.arc
+void dry_run_installation() {
+    loadOffsets();
+    std::map<u64, const modTarget*> targets = resolveTargets(manager_root, selectedByPriority(), offsetObj);
+    if(compContext == nullptr) compContext = ZSTD_createCCtx();
+    printf("\nEstimating installation...\n\n");
+    printScanTime();
+    refreshConsole();
+
+    installEstimate estimate;
+    // files an install would report as "offset not parsable"
+    for (const std::string& mod : selectedByPriority()) {
+        for (const std::string& path : unresolvedCache[mod]) {
+            fileEstimate file = {mod + "/" + path, 0, 0, 0, 0, 0, "fail", "offset not parsable"};
+            addEstimate(estimate, file, 0, sdWriteRate);
+        }
+    }
+    size_t done = 0;
+    for (auto& [offset, resolved] : targets) {
+        if (installCancelled())
+            break;
+        reportProgress("Estimating", done++, targets.size(), 0);
+        estimateTarget(*resolved, compContext, estimate, false);
+    }
+
+    printf("Files:            %lu\n", estimate.files.size());
+    printf("Data.arc writes:  %lu KiB\n", estimate.writeBytes / 1024);
+    printf("New backups:      %lu KiB\n", estimate.backupBytes / 1024);
+    printf("To compress:      %lu KiB\n", estimate.compressBytes / 1024);
+    printf("Estimated time:   %.0f seconds\n\n", estimate.compressSeconds + estimate.ioSeconds);
+    size_t shown = 0;
+    for (const fileEstimate& file : estimate.files) {
+        if (file.problem.empty() || file.action == std::string("unchanged")) continue;
+        if (shown++ < 10)
+            printf(CONSOLE_RED "%s: %s\n" CONSOLE_RESET, file.path.c_str(), file.problem.c_str());
+    }
+    if (estimate.failures > 10)
+        printf(CONSOLE_RED "...and %lu more\n" CONSOLE_RESET, estimate.failures - 10);
+    if (writeEstimateJSON(estimate, dryRunReportPath))
+        printf("\nReport written to %s\n", dryRunReportPath);
+
+    mod_dirs.clear();
+    printf("Dry run finished.\nPress B to return to the Mod Installer.\n\n");
+}
+
+Thread indexerThread;
+bool indexerRunning = false;
+bool indexComplete = false;  // every folder in the menu has been indexed
+std::atomic<bool> indexerStop(false);
+std::atomic<bool> indexerFinished(false);
+std::vector<std::string> indexFolders;
+
+// Fills modIndexObj for the folders in the menu. While it runs the indexer has the target
+// caches, Offsets.txt and the manifest to itself, so the main thread calls stopIndexer()
+// before using any of them. The targets it resolves stay cached for the install.
+void indexMods(void*) {
+    loadOffsets(true);
+    manifest.load();
+    ZSTD_CCtx* cctx = ZSTD_createCCtx();
+    std::map<std::string, u64> installed;
+    size_t modsLen = strlen(mods_root);
+    for (auto& [offset, entry] : manifest.regions) {
+        if (entry.source.compare(0, modsLen, mods_root) == 0)
+            installed[entry.source.substr(modsLen, entry.source.find('/', modsLen) - modsLen)]++;
+    }
+    for (const std::string& name : indexFolders) {
+        std::string modDir = "mods/" + name;
+        const std::vector<modTarget>& targets = getModTargets(manager_root, modDir, offsetObj);
+        u64 files = targets.size() + unresolvedCache[modDir].size();
+        modInfo info;
+        // sizes and estimates are only redone when a folder in the mod changed
+        if (!modIndexObj.get(name, info) || info.stamp != modStampCache[modDir] || info.files != files) {
+            installEstimate estimate;
+            for (size_t i = 0; i < targets.size() && !indexerStop; i++)
+                estimateTarget(targets[i], cctx, estimate, true);
+            if (indexerStop)
+                break;
+            info = {modStampCache[modDir], files, targets.size(), 0, 0, estimate.failures,
+                    estimate.compressSeconds + estimate.ioSeconds, 0, ""};
+            for (const fileEstimate& file : estimate.files) {
+                info.size += file.modSize;
+                if (file.predictedSize) info.compressFiles++;
+            }
+            std::set<std::string> tags;
+            for (const modTarget& target : targets)
+                addArcPathTag(tags, target.arcPath);
+            info.tags = joinTags(tags);
+        }
+        info.installed = installed[name];
+        modIndexObj.set(name, info);
+        if (indexerStop)
+            break;
+    }
+    ZSTD_freeCCtx(cctx);
+    if (!indexerStop)
+        modIndexObj.keepOnly(indexFolders);
+    modIndexObj.save();
+    indexerFinished = true;
+}
+
+void stopIndexer() {
+    if (!indexerRunning)
+        return;
+    bool finished = indexerFinished;
+    indexerStop = true;
+    threadWaitForExit(&indexerThread);
+    threadClose(&indexerThread);
+    indexerRunning = false;
+    indexComplete = finished;
+    if (finished)
+        searchStale = true;  // the tags of the new entries
+}
+
+// Called every menu frame, starts the indexer while there is something left to index
+void updateIndexer() {
+    if (indexerRunning && indexerFinished)
+        stopIndexer();
+    if (indexerRunning || indexComplete)
+        return;
+    if (modFolders.empty()) {
+        indexComplete = true;
+        return;
+    }
+    modIndexObj.load();
+    indexFolders = modFolders;
+    indexerStop = false;
+    indexerFinished = false;
+    if (R_FAILED(threadCreate(&indexerThread, indexMods, nullptr, INDEXER_STACK_SIZE, 0x3B, -2))) {
+        indexComplete = true;
+        return;
+    }
+    if (R_FAILED(threadStart(&indexerThread))) {
+        threadClose(&indexerThread);
+        indexComplete = true;
+        return;
+    }
+    indexerRunning = true;
+}
+
+// Brings data.arc from what the manifest says is installed to the mods of a profile.
+// Regions only the current state has are restored, regions that are new or whose source
+// changed are written, and regions identical in both are not touched.
+void switch_profile(const std::string& name) {
+    std::vector<std::string> mods = loadProfile(name);
+    FILE* f_arc = fopen(arcPath().c_str(), "r+b");
+    if (!f_arc) {
+        printf(CONSOLE_RED "Failed to get file handle to data.arc\n" CONSOLE_RESET);
+        return;
+    }
+    printf("\nSwitching to profile " CONSOLE_YELLOW "%s\n\n" CONSOLE_RESET, name.c_str());
+    refreshConsole();
+    timingStart();
+    loadOffsets();
+    manifest.load();
+    checkVanillaSource(f_arc);
+    mkdir(backups_root, 0777);
+    for (std::string& mod : mods)
+        mod = "mods/" + mod;
+    std::map<u64, const modTarget*> targets = resolveTargets(manager_root, mods, offsetObj);
+    printScanTime();
+
+    journalOpen();
+    checkpointOpen();
+    char* backup_path = new char[FILENAME_SIZE];
+    size_t leaving = 0, arriving = 0, unchanged = 0;
+    for (auto& [offset, entry] : manifest.regions) {
+        if (targets.find(offset) != targets.end())
+            continue;  // overwritten by the profile, the existing backup stays valid
+        snprintf(backup_path, FILENAME_SIZE, "%s0x%lx.backup", backups_root, offset);
+        if (fileExists(std::string(backup_path)))
+            queue_restore(backup_path, offset);
+        else if (backupMode == BACKUP_MODE_ROMFS)
+            queue_vanilla_restore(offset, entry.size);
+        else {
+            printf(CONSOLE_RED "No backup for 0x%lx, left as is\n" CONSOLE_RESET, offset);
+            continue;
+        }
+        leaving++;
+    }
+    delete[] backup_path;
+    bulk_restore(f_arc);
+
+    appletSetCpuBoostMode(ApmCpuBoostMode_Type1);
+    size_t done = 0;
+    u64 bytes = 0;
+    for (auto& [offset, target] : targets) {
+        if (installCancelled())
+            break;
+        reportProgress("Installing", done++, targets.size(), bytes);
+        if (is_unchanged(*target)) {
+            unchanged++;
+            continue;
+        }
+        bytes += target->size;
+        fileTimer timer(target->filePath, offset, target->size);
+        if (load_target(*target, f_arc) == 0)
+            printf(CONSOLE_GREEN "%s\n\n" CONSOLE_RESET, target->filePath.c_str());
+        refreshConsole();
+        arriving++;
+    }
+    appletSetCpuBoostMode(ApmCpuBoostMode_Disabled);
+
+    verifyWrittenRegions(f_arc);
+    fclose(f_arc);
+    journalClose();
+    checkpointClose(manifest.save());
+    if (installCancelled()) {
+        remove(activeProfilePath);  // only part of the profile was written
+        printf(CONSOLE_YELLOW "Cancelled, %lu file(s) of the profile were not written\n" CONSOLE_RESET, targets.size() - done);
+    }
+    else
+        setActiveProfile(name);
+    printMemoryPeak();
+    timingFinish(reportsRoot, "profile", mods);
+    finishCompressionStats(compStatsPath);
+    printf("Profile switched: %lu region(s) restored, %lu written, %lu unchanged\n", leaving, arriving, unchanged);
+    printf("Press B to return to the Mod Installer.\n");
+    printf("Press X to launch Smash\n\n");
+}
+
+// Resolves all selected mods to one winning file per region before writing anything,
+// so every region is compressed and written exactly once.
+void install_resolved(FILE* f_arc) {
+    std::vector<std::string> mods = selectedByPriority();
+    loadOffsets();
+    std::map<u64, const modTarget*> targets = resolveTargets(manager_root, mods, offsetObj);
+    size_t total = 0;
+    for (const std::string& mod : mods) {
+        total += getModTargets(manager_root, mod, offsetObj).size();
+        for (const std::string& file : unresolvedCache[mod])
+            printf(CONSOLE_RED "Found file '%s/%s', offset not parsable\n" CONSOLE_RESET, mod.c_str(), file.c_str());
+    }
+    printScanTime();
+    if (total > targets.size())
+        printf("%lu file(s) overridden by higher priority mods\n\n", total - targets.size());
+    refreshConsole();
+
+    size_t done = 0, failed = 0;
+    u64 bytes = 0;
+    for (auto& [offset, target] : targets) {
+        if (installCancelled()) {
+            printf(CONSOLE_YELLOW "Cancelled, %lu of %lu file(s) were not installed\n\n" CONSOLE_RESET, targets.size() - done, targets.size());
+            break;
+        }
+        reportProgress("Installing", done, targets.size(), bytes);
+        fileTimer timer(target->filePath, offset, target->size);
+        appletSetCpuBoostMode(ApmCpuBoostMode_Type1);
+        int ret = load_target(*target, f_arc);
+        appletSetCpuBoostMode(ApmCpuBoostMode_Disabled);
+        if (ret == 0)
+            printf(CONSOLE_GREEN "%s\n\n" CONSOLE_RESET, target->filePath.c_str());
+        else {
+            printf(CONSOLE_RED "%s was not installed\n\n" CONSOLE_RESET, target->filePath.c_str());
+            failed++;
+        }
+        refreshConsole();
+        done++;
+        bytes += target->size;
+    }
+    if (failed > 0)
+        printf(CONSOLE_RED "%lu of %lu file(s) failed to install\n\n" CONSOLE_RESET, failed, done);
+    // "backups" is left for load_mods() to restore
+    mod_dirs.erase(std::remove_if(mod_dirs.begin(), mod_dirs.end(),
+                                  [](const std::string& mod_dir) { return mod_dir != "backups"; }),
+                   mod_dirs.end());
+}
+
 void perform_installation() {
-    std::string rootModDir = std::string(manager_root) + mod_dirs[num_mod_dirs-1];
-    std::string arc_path = "sdmc:/" + getCFW() + "/titles/01006A800016E000/romfs/data.arc";
+    std::string rootModDir = std::string(manager_root) + cursorModDir;
+    std::vector<std::string> reportMods = mod_dirs;
+    std::string arc_path = arcPath();
     FILE* f_arc;
     if(!std::filesystem::exists(arc_path)) {
       printf(CONSOLE_RED "\nNo data.arc found!\n" CONSOLE_RESET);
@@ -417,21 +1671,55 @@ void perform_installation() {
         printf(CONSOLE_RED "Failed to get file handle to data.arc\n" CONSOLE_RESET);
         goto end;
     }
+    checkVanillaSource(f_arc);
     if (installing == INSTALL)
         printf("\nInstalling mods...\n\n");
     else if (installing == UNINSTALL)
         printf("\nUninstalling mods...\n\n");
-    consoleUpdate(NULL);
-    while (num_mod_dirs > 0) {
-        consoleUpdate(NULL);
-        load_mods(f_arc);
+    refreshConsole();
+    timingStart();
+    reportConflicts();
+    journalOpen();
+    checkpointOpen();
+    if (installing == INSTALL)
+        install_resolved(f_arc);
+    for (const std::string& mod_dir : mod_dirs) {
+        if (installCancelled())
+            break;
+        refreshConsole();
+        load_mods(f_arc, mod_dir);
+    }
+    mod_dirs.clear();
+    if (restoreAllRegions && backupMode == BACKUP_MODE_ROMFS) {
+        // regions installed without a backup file are only known from the manifest
+        manifest.load();
+        for (auto& [offset, entry] : manifest.regions)
+            queue_vanilla_restore(offset, entry.size);
     }
+    restoreAllRegions = false;
+    bulk_restore(f_arc);
 
-    free(mod_dirs);
+    verifyWrittenRegions(f_arc);
     fclose(f_arc);
-    if (deleteMod) {
+    journalClose();
+    checkpointClose(manifest.save());
+    remove(activeProfilePath);  // data.arc no longer matches a profile
+    if (backupsCompressed > 0) {
+        printf("Compressed %lu of %lu backups, saving %lu KiB\n", backupsCompressed,
+               backupsCompressed + backupsStoredRaw, backupBytesSaved / 1024);
+    }
+    backupsCompressed = backupsStoredRaw = backupBytesSaved = 0;
+    printMemoryPeak();
+    timingFinish(reportsRoot, installing == INSTALL ? "install" : "uninstall", reportMods);
+    finishCompressionStats(compStatsPath);
+    if (deleteMod && installCancelled())
+      printf(CONSOLE_YELLOW "Cancelled, mod files were not deleted\n" CONSOLE_RESET);
+    else if (deleteMod && !cursorModDir.empty()) {
       printf("Deleting mod files\n");
-      fsdevDeleteDirectoryRecursively(rootModDir.c_str());
+      if (isPackedMod(rootModDir))
+        remove(rootModDir.c_str());
+      else
+        fsdevDeleteDirectoryRecursively(rootModDir.c_str());
     }
 
 end:
@@ -439,11 +1727,186 @@ end:
     printf("Press X to launch Smash\n\n");
 }
 
+// Rereads the mods folder, priority.txt and the profiles. The multi-selection is kept by
+// name when keepSelection is set and cleared otherwise.
+void refreshModFolders(bool keepSelection) {
+    stopIndexer();
+    std::vector<std::string> selected;
+    for (size_t i = 0; keepSelection && i < modFolders.size(); i++) {
+        if (selectedFolders[i]) selected.push_back(modFolders[i]);
+    }
+    modFolders.clear();
+    DIR* d = opendir(mods_root);
+    modFoldersFound = d != nullptr;
+    if (d) {
+        struct dirent *dir;
+        while ((dir = readdir(d)) != NULL) {
+            if ((dir->d_type == DT_DIR && strcmp(dir->d_name, ".") != 0 && strcmp(dir->d_name, "..") != 0) ||
+                (dir->d_type == DT_REG && isPackedMod(dir->d_name)))
+                modFolders.push_back(dir->d_name);
+        }
+        closedir(d);
+    }
+    sortByPriority(modFolders, loadPriority());
+    selectedFolders.assign(modFolders.size(), false);
+    for (size_t i = 0; i < modFolders.size(); i++)
+        selectedFolders[i] = std::find(selected.begin(), selected.end(), modFolders[i]) != selected.end();
+    menuProfiles = listProfiles();
+    menuActiveProfile = activeProfile();
+    modFoldersStale = false;
+    indexComplete = false;
+    selectionChanged = true;
+    searchStale = true;
+}
+
+std::string workerProfile;
+
+// Jobs started from the menu, run on the install worker
+void installJob() {
+    if (dryRun)
+        dry_run_installation();
+    else {
+        mkdir(backups_root, 0777);
+        perform_installation();
+    }
+}
+
+void switchProfileJob() {
+    switch_profile(workerProfile);
+}
+
+// Back on the menu thread once a job is done
+void finishJob() {
+    mod_dirs.clear();
+    installation_finish = true;
+    if (!dryRun) {
+        modFoldersStale = true;
+        clearModTargetCache();
+    }
+}
+
+void rebuildSearch() {
+    std::vector<std::string> tags(modFolders.size());
+    modInfo info;
+    for (size_t i = 0; i < modFolders.size(); i++) {
+        if (modIndexObj.get(modFolders[i], info))
+            tags[i] = info.tags;
+    }
+    search.build(modFolders, tags);
+    searchStale = false;
+}
+
+// Asks for a search with the full software keyboard, used when the inline one can not be
+// shown. Returns current if it was cancelled.
+std::string askSearchQuery(const std::string& current) {
+    SwkbdConfig kbd;
+    char query[0x40] = "";
+    if (R_FAILED(swkbdCreate(&kbd, 0)))
+        return current;
+    swkbdConfigMakePresetDefault(&kbd);
+    swkbdConfigSetGuideText(&kbd, "Mod, fighter or stage");
+    swkbdConfigSetInitialText(&kbd, current.c_str());
+    swkbdConfigSetStringLenMax(&kbd, sizeof(query) - 1);
+    Result rc = swkbdShow(&kbd, query, sizeof(query));
+    swkbdClose(&kbd);
+    return R_SUCCEEDED(rc) ? std::string(query) : current;
+}
+
+// The inline keyboard reports every keystroke, so the list is filtered while typing.
+// Its callbacks run inside swkbdInlineUpdate() and only record what happened.
+SwkbdInline searchKeyboard;
+bool searchTyping = false;
+bool searchTypingDone = false;
+bool searchTypedChanged = false;
+std::string searchTyped;
+std::string searchBeforeTyping;
+
+void searchKeyboardChanged(const char* str, SwkbdChangedStringArg*) {
+    searchTyped = str;
+    searchTypedChanged = true;
+}
+
+void searchKeyboardEnter(const char* str, SwkbdDecidedEnterArg*) {
+    searchTyped = str;
+    searchTypedChanged = true;
+    searchTypingDone = true;
+}
+
+void searchKeyboardCancel() {
+    searchTyped = searchBeforeTyping;
+    searchTypedChanged = true;
+    searchTypingDone = true;
+}
+
+// Returns false if the inline keyboard could not be shown
+bool startSearchKeyboard(const std::string& current) {
+    if (R_FAILED(swkbdInlineCreate(&searchKeyboard)))
+        return false;
+    if (R_FAILED(swkbdInlineLaunchForLibraryApplet(&searchKeyboard, SwkbdInlineMode_AppletDisplay, 0))) {
+        swkbdInlineClose(&searchKeyboard);
+        return false;
+    }
+    swkbdInlineSetUtf8Mode(&searchKeyboard, true);
+    swkbdInlineSetChangedStringCallback(&searchKeyboard, searchKeyboardChanged);
+    swkbdInlineSetDecidedEnterCallback(&searchKeyboard, searchKeyboardEnter);
+    swkbdInlineSetDecidedCancelCallback(&searchKeyboard, searchKeyboardCancel);
+    SwkbdAppearArg appear;
+    swkbdInlineMakeAppearArg(&appear, SwkbdType_Normal);
+    swkbdInlineAppearArgSetOkButtonText(&appear, "Done");
+    swkbdInlineAppear(&searchKeyboard, &appear);
+    swkbdInlineSetInputText(&searchKeyboard, current.c_str());
+    swkbdInlineSetCursorPos(&searchKeyboard, current.size());
+    searchBeforeTyping = current;
+    searchTyping = true;
+    searchTypingDone = false;
+    searchTypedChanged = false;
+    return true;
+}
+
+void updateSearchKeyboard() {
+    if (R_FAILED(swkbdInlineUpdate(&searchKeyboard, NULL)))
+        searchTypingDone = true;
+    if (searchTypedChanged) {
+        searchTypedChanged = false;
+        if (searchTyped != search.query) {
+            search.setQuery(searchTyped);
+            mod_folder_index = 0;
+        }
+    }
+    if (searchTypingDone) {
+        swkbdInlineClose(&searchKeyboard);
+        searchTyping = false;
+    }
+}
+
+void printModLine(const std::string& name) {
+    modInfo info;
+    char line[78];
+    if (modIndexObj.get(name, info))
+        snprintf(line, sizeof(line), "%s  %lu files, %.1f MiB, ~%.0f s%s%s", name.c_str(), info.targets,
+                 info.size / 1048576.0, info.seconds, info.compressFiles ? ", compresses" : "",
+                 info.installed ? ", installed" : "");
+    else
+        snprintf(line, sizeof(line), "%s", name.c_str());
+    printf("%s\n", line);
+}
+
 void modInstallerMainLoop(int kDown)
 {
+    if (workerRunning) {
+        if (updateWorker(kDown))
+            finishJob();
+        return;
+    }
     if (!installation_finish) {
         consoleClear();
-        u64 kHeld = hidKeysHeld(CONTROLLER_P1_AUTO);
+        // the buttons belong to the keyboard while it is shown
+        bool typing = searchTyping;
+        if (typing) {
+            updateSearchKeyboard();
+            kDown = 0;
+        }
+        u64 kHeld = typing ? 0 : hidKeysHeld(CONTROLLER_P1_AUTO);
         if (kHeld & KEY_RSTICK_DOWN) {
             svcSleepThread(7e+7);
             mod_folder_index++;
@@ -452,20 +1915,66 @@ void modInstallerMainLoop(int kDown)
             svcSleepThread(7e+7);
             mod_folder_index--;
         }
-        if(kDown & KEY_ZR) {
-            std::list<s64>::iterator it = std::find(installIDXs.begin(), installIDXs.end(), mod_folder_index);
-            if(it == installIDXs.end())
-                installIDXs.push_back(mod_folder_index);
-            else
-                installIDXs.erase(it);
+        if (kDown & KEY_RSTICK) {
+            stopIndexer();
+            clearModTargetCache();
+            refreshModFolders(true);
+        }
+        else if (modFoldersStale)
+            refreshModFolders(false);
+        if (kDown & KEY_LSTICK && !startSearchKeyboard(search.query)) {
+            std::string query = askSearchQuery(search.query);
+            if (query != search.query) {
+                search.setQuery(query);
+                mod_folder_index = 0;
+            }
+        }
+        if (searchStale)
+            rebuildSearch();
+
+        // The list is the matching folders, then backups and the profiles unless searching.
+        // Only the page around the cursor is printed.
+        const std::vector<std::string>& profiles = menuProfiles;
+        s64 folderRows = search.active() ? search.matches.size() : modFolders.size();
+        s64 rows = folderRows + (search.active() ? 0 : 1 + profiles.size());
+        auto folderAt = [&](s64 row) -> s64 {
+            if (row < 0 || row >= folderRows) return -1;
+            return search.active() ? search.matches[row] : row;
+        };
+
+        s64 prev_folder_index = mod_folder_index;
+        s64 cursorFolder = folderAt(mod_folder_index);
+        if (kDown & KEY_ZR && cursorFolder >= 0) {
+            selectedFolders[cursorFolder] = !selectedFolders[cursorFolder];
+            selectionChanged = true;
         }
         if (kDown & KEY_DDOWN || kDown & KEY_LSTICK_DOWN)
             mod_folder_index++;
         else if (kDown & KEY_DUP || kDown & KEY_LSTICK_UP)
             mod_folder_index--;
+        if (mod_folder_index < 0)
+            mod_folder_index = std::max(rows - 1, (s64)0);
+        if (mod_folder_index >= rows)
+            mod_folder_index = 0;
+
+        // L + up/down moves the folder under the cursor in the priority order
+        if (kHeld & KEY_L && !search.active() && mod_folder_index != prev_folder_index && prev_folder_index >= 0 &&
+            prev_folder_index < folderRows && mod_folder_index < folderRows) {
+            std::swap(modFolders[prev_folder_index], modFolders[mod_folder_index]);
+            savePriority(modFolders);
+            bool prevSelected = selectedFolders[prev_folder_index];
+            selectedFolders[prev_folder_index] = selectedFolders[mod_folder_index];
+            selectedFolders[mod_folder_index] = prevSelected;
+            selectionChanged = true;
+            searchStale = true;
+        }
+        cursorFolder = folderAt(mod_folder_index);
+        bool cursorOnBackups = !search.active() && mod_folder_index == folderRows;
 
         bool start_install = false;
+        bool save_profile = (kDown & KEY_ZL) != 0;
         deleteMod = false;
+        dryRun = false;
         if(kDown & KEY_L && kDown & KEY_R && kDown & KEY_Y) {
           printf("del\n");
           deleteMod = true;
@@ -480,77 +1989,120 @@ void modInstallerMainLoop(int kDown)
             start_install = true;
             installing = UNINSTALL;
         }
+        else if (kDown & KEY_MINUS) {
+            start_install = true;
+            installing = INSTALL;
+            dryRun = true;
+        }
         bool found_dir = false;
+        std::string switchTo;
 
-        printf("Please select a mods folder.\n\n");
+        if (search.active() || searchTyping)
+            printf("Search: " CONSOLE_YELLOW "%s" CONSOLE_RESET " (%lu of %lu mods)\n\n", search.query.c_str(),
+                   search.matches.size(), modFolders.size());
+        else
+            printf("Please select a mods folder.\n\n");
         printf(CONSOLE_ESC(s) CONSOLE_ESC(44;1H) GREEN "A" RESET "=install "
                GREEN "Y" RESET "=uninstall " GREEN "L+R+Y" RESET "=delete "
-               GREEN "R-Stick" RESET "=scroll " GREEN "ZR" RESET "=multi-select" CONSOLE_ESC(u));
+               GREEN "R-Stick" RESET "=scroll " GREEN "ZR" RESET "=multi-select"
+               CONSOLE_ESC(45;1H) GREEN "-" RESET "=dry run " GREEN "ZL" RESET "=save profile "
+               GREEN "L+Up/Down" RESET "=change priority " GREEN "R3" RESET "=refresh " GREEN "L3" RESET "=search" CONSOLE_ESC(u));
 
-        DIR* d = opendir(mods_root);
-        struct dirent *dir;
-        if (d) {
-            s64 curr_folder_index = 0;
-            while ((dir = readdir(d)) != NULL) {
-                std::string d_name = std::string(dir->d_name);
-                if(dir->d_type == DT_DIR) {
-                    if (d_name == "." || d_name == "..")
-                        continue;
-                    std::string directory = "mods/" + d_name;
-
-                    if (curr_folder_index == mod_folder_index) {
-                        printf("%s> ", CONSOLE_GREEN);
-                        if (start_install) {
-                            found_dir = true;
-                            add_mod_dir(directory.c_str());
-                        }
-                    }
-                    else if(std::find(installIDXs.begin(), installIDXs.end(), curr_folder_index) != installIDXs.end()) {
-                        printf(CONSOLE_CYAN);
-                        if (start_install) {
-                            add_mod_dir(directory.c_str());
-                        }
-                    }
-                    if(curr_folder_index < 42 || curr_folder_index <= mod_folder_index)
-                        printf("%s\n", dir->d_name);
-                    printf(CONSOLE_RESET);
-                    curr_folder_index++;
+        if (modFoldersFound) {
+            if (mod_folder_index < menu_scroll)
+                menu_scroll = mod_folder_index;
+            if (mod_folder_index >= menu_scroll + MENU_ROWS)
+                menu_scroll = mod_folder_index - MENU_ROWS + 1;
+            if (menu_scroll > std::max(rows - MENU_ROWS, (s64)0))
+                menu_scroll = std::max(rows - MENU_ROWS, (s64)0);
+
+            const std::string& active = menuActiveProfile;
+            for (s64 row = menu_scroll; row < rows && row < menu_scroll + MENU_ROWS; row++) {
+                s64 folder = folderAt(row);
+                if (row == mod_folder_index)
+                    printf(CONSOLE_GREEN "> ");
+                else if (folder >= 0 && selectedFolders[folder])
+                    printf(CONSOLE_CYAN);
+                if (folder >= 0)
+                    printModLine(modFolders[folder]);
+                else if (row == folderRows)
+                    printf("backups\n");
+                else {
+                    const std::string& profile = profiles[row - folderRows - 1];
+                    printf("profile: %s%s\n", profile.c_str(), profile == active ? " (active)" : "");
                 }
+                printf(CONSOLE_RESET);
             }
 
-            if (mod_folder_index < 0)
-                mod_folder_index = curr_folder_index;
-
-            if (mod_folder_index > curr_folder_index)
-                mod_folder_index = 0;
-
-            if (mod_folder_index == curr_folder_index) {
-                printf(CONSOLE_GREEN "> ");
-                if (start_install) {
-                    found_dir = true;
-                    add_mod_dir("backups");
+            std::string cursorDir = cursorFolder >= 0 ? modFolders[cursorFolder] : "";
+            if (start_install && (cursorFolder >= 0 || cursorOnBackups)) {
+                found_dir = true;
+                for (size_t i = 0; i < modFolders.size(); i++) {
+                    if ((s64)i == cursorFolder || selectedFolders[i])
+                        mod_dirs.push_back("mods/" + modFolders[i]);
                 }
+                if (cursorOnBackups)
+                    mod_dirs.push_back("backups");
+                cursorModDir = cursorOnBackups ? "backups" : "mods/" + cursorDir;
             }
+            else if (start_install && installing == INSTALL && !dryRun && mod_folder_index > folderRows && !search.active())
+                switchTo = profiles[mod_folder_index - folderRows - 1];
 
-            if(curr_folder_index < 42 || curr_folder_index <= mod_folder_index) printf("backups\n");
+            if (selectionChanged) {
+                selectionChanged = false;
+                selectedDirs.clear();
+                for (size_t i = modFolders.size(); i-- > 0;) {
+                    if (selectedFolders[i])
+                        selectedDirs.push_back("mods/" + modFolders[i]);
+                }
+                // scans are cached per folder, so this is only slow the first time a folder is selected
+                selectionConflicts = 0;
+                if (selectedDirs.size() > 1) {
+                    stopIndexer();
+                    loadOffsets();
+                    selectionConflicts = findConflicts(manager_root, selectedDirs, offsetObj).size();
+                }
+            }
 
-            if (mod_folder_index == curr_folder_index)
-                printf(CONSOLE_RESET);
+            if (save_profile) {
+                // a profile lists the winner first, like priority.txt
+                std::vector<std::string> profileMods;
+                if (!cursorDir.empty())
+                    profileMods.push_back(cursorDir);
+                for (const std::string& dir : selectedDirs) {
+                    std::string mod = dir.substr(strlen("mods/"));
+                    if (mod != cursorDir) profileMods.push_back(mod);
+                }
+                sortByPriority(profileMods, modFolders);
+                if (!profileMods.empty()) {
+                    std::string name = newProfileName();
+                    saveProfile(name, profileMods);
+                    modFoldersStale = true;
+                }
+            }
 
-            closedir(d);
+            if (selectionConflicts > 0)
+                printf(CONSOLE_ESC(s) CONSOLE_ESC(43;1H) YELLOW "%lu overlapping region(s) between selected mods" RESET CONSOLE_ESC(u),
+                       selectionConflicts);
         } else {
             printf(CONSOLE_RED "%s folder not found\n\n" CONSOLE_RESET, mods_root);
         }
 
-        consoleUpdate(NULL);
-        if (start_install && found_dir) {
+        if (!switchTo.empty() || (start_install && found_dir))
+            stopIndexer();
+        else
+            updateIndexer();
+        refreshConsole();
+        if (!switchTo.empty() || (start_install && found_dir)) {
             consoleClear();
-            mkdir(backups_root, 0777);
-            perform_installation();
-            installation_finish = true;
-            mod_dirs = NULL;
-            num_mod_dirs = 0;
-            installIDXs.clear();
+            loadConfig();
+            workerProfile = switchTo;
+            void (*job)() = switchTo.empty() ? installJob : switchProfileJob;
+            if (!startWorker(job)) {
+                job();
+                finishJob();
+            }
+            return;
         }
     }
 
@@ -559,7 +2111,12 @@ void modInstallerMainLoop(int kDown)
           installation_finish = false;
           consoleClear();
         }
+        else if (search.active()) {
+          search.setQuery("");
+          mod_folder_index = 0;
+        }
         else {
+          stopIndexer();
           if(offsetObj != nullptr) {
               delete offsetObj;
               offsetObj = nullptr;
@@ -568,6 +2125,7 @@ void modInstallerMainLoop(int kDown)
             ZSTD_freeCCtx(compContext);
             compContext = nullptr;
           }
+          freeBackupContexts();
           menu = MAIN_MENU;
           printMainMenu();
         }
@@ -1,4 +1,9 @@
+#pragma once
+#include <stdlib.h>
+#include <array>
+#include <fstream>
 #include <map>
+#include <string>
 
 class offsetFile
 {
@@ -0,0 +1,167 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "xxhash64.h"
+
+/*
+ * .umm mod package: every file of a mod already compressed and padded to its region size,
+ * so installing is one sequential read and nothing is compressed on the console.
+ *   ummHeader
+ *   numEntries manifest records: ummRecord, then pathLen bytes of arc path (may be empty)
+ *   payloads, compSize bytes each, in data.arc offset order
+ * Entries with an arc path are placed with Offsets.txt when it is available, and skipped
+ * if the region sizes there no longer match. The stored offset is used otherwise.
+ */
+#define UMM_EXT ".umm"
+
+const char ummMagic[8] = {'U','M','M','P','K','G','0','1'};
+
+struct ummHeader {
+  char magic[8];
+  uint32_t numEntries;
+  uint32_t flags;
+  uint64_t manifestSize;
+};
+
+struct ummRecord {
+  uint64_t offset;
+  uint64_t compSize;    // size of the payload, the region size unless the region is uncompressed
+  uint64_t decompSize;  // decompressed size of the region in Offsets.txt
+  uint64_t hash;        // XXH64 of the payload
+  uint64_t dataOffset;  // payload position in the package
+  uint32_t pathLen;
+  uint32_t reserved;
+};
+
+struct ummEntry {
+  uint64_t offset;
+  uint64_t compSize;
+  uint64_t decompSize;
+  uint64_t hash;
+  uint64_t dataOffset;
+  std::string arcPath;
+};
+
+bool isModPackage(const std::string& name) {
+  size_t extLen = strlen(UMM_EXT);
+  return name.size() > extLen && name.compare(name.size() - extLen, extLen, UMM_EXT) == 0;
+}
+
+class ummPackage {
+public:
+  std::string path;
+  uint64_t mtime = 0;
+  std::vector<ummEntry> entries;
+
+  ummPackage(const std::string& packagePath) : path(packagePath) {
+    struct stat st;
+    if(stat(path.c_str(), &st) == 0) mtime = st.st_mtime;
+    f = fopen(path.c_str(), "rb");
+    if(f != nullptr && !readManifest()) entries.clear();
+  }
+
+  ~ummPackage() {
+    if(f != nullptr) fclose(f);
+  }
+
+  bool valid() const { return !entries.empty(); }
+
+  // out must hold entry.compSize bytes. Entries read in order need no seeks.
+  bool read(const ummEntry& entry, char* out) {
+    if(f == nullptr) return false;
+    if((uint64_t)ftell(f) != entry.dataOffset)
+      fseek(f, entry.dataOffset, SEEK_SET);
+    if(fread(out, sizeof(char), entry.compSize, f) != entry.compSize)
+      return false;
+    return xxhash64::hash(out, entry.compSize) == entry.hash;
+  }
+
+  // Reads an entry through chunk, copying it to out unless out is null.
+  // Returns false on a read error or a hash mismatch.
+  bool stream(const ummEntry& entry, FILE* out, char* chunk, uint64_t chunkSize) {
+    if(f == nullptr) return false;
+    fseek(f, entry.dataOffset, SEEK_SET);
+    xxhash64 hash;
+    for(uint64_t done = 0; done < entry.compSize;) {
+      uint64_t size = std::min(chunkSize, entry.compSize - done);
+      if(fread(chunk, sizeof(char), size, f) != size) return false;
+      hash.update(chunk, size);
+      if(out != nullptr) fwrite(chunk, sizeof(char), size, out);
+      done += size;
+    }
+    return hash.digest() == entry.hash;
+  }
+
+  // Whether the payload is a zstd frame rather than an uncompressed file
+  bool isFrame(const ummEntry& entry) {
+    unsigned char magic[4] = {0};
+    if(f == nullptr || entry.compSize < sizeof(magic)) return false;
+    fseek(f, entry.dataOffset, SEEK_SET);
+    fread(magic, 1, sizeof(magic), f);
+    return magic[0] == 0x28 && magic[1] == 0xB5 && magic[2] == 0x2F && magic[3] == 0xFD;
+  }
+
+private:
+  FILE* f = nullptr;
+
+  bool readManifest() {
+    ummHeader header;
+    if(fread(&header, sizeof(header), 1, f) != 1 || memcmp(header.magic, ummMagic, sizeof(ummMagic)) != 0)
+      return false;
+    std::vector<char> manifest(header.manifestSize);
+    if(fread(manifest.data(), 1, manifest.size(), f) != manifest.size())
+      return false;
+    size_t pos = 0;
+    for(uint32_t i = 0; i < header.numEntries; i++) {
+      ummRecord record;
+      if(manifest.size() - pos < sizeof(record)) return false;
+      memcpy(&record, &manifest[pos], sizeof(record));
+      pos += sizeof(record);
+      if(manifest.size() - pos < record.pathLen) return false;
+      ummEntry entry = {record.offset, record.compSize, record.decompSize, record.hash, record.dataOffset,
+                        std::string(&manifest[pos], record.pathLen)};
+      pos += record.pathLen;
+      entries.push_back(entry);
+    }
+    return true;
+  }
+};
+
+// Writes a package. payloads[i] holds entries[i].compSize bytes; hash and dataOffset are filled in.
+bool writeUmmPackage(const std::string& path, std::vector<ummEntry>& entries, const std::vector<const char*>& payloads) {
+  std::vector<size_t> order(entries.size());
+  for(size_t i = 0; i < order.size(); i++) order[i] = i;
+  std::sort(order.begin(), order.end(), [&entries](size_t a, size_t b) { return entries[a].offset < entries[b].offset; });
+
+  ummHeader header;
+  memcpy(header.magic, ummMagic, sizeof(ummMagic));
+  header.numEntries = entries.size();
+  header.flags = 0;
+  header.manifestSize = 0;
+  for(const ummEntry& entry : entries)
+    header.manifestSize += sizeof(ummRecord) + entry.arcPath.size();
+  uint64_t dataOffset = sizeof(header) + header.manifestSize;
+
+  FILE* f = fopen(path.c_str(), "wb");
+  if(f == nullptr) return false;
+  bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+  for(size_t i : order) {
+    ummEntry& entry = entries[i];
+    entry.hash = xxhash64::hash(payloads[i], entry.compSize);
+    entry.dataOffset = dataOffset;
+    dataOffset += entry.compSize;
+    ummRecord record = {entry.offset, entry.compSize, entry.decompSize, entry.hash, entry.dataOffset,
+                        (uint32_t)entry.arcPath.size(), 0};
+    ok &= fwrite(&record, sizeof(record), 1, f) == 1;
+    ok &= fwrite(entry.arcPath.data(), 1, entry.arcPath.size(), f) == entry.arcPath.size();
+  }
+  for(size_t i : order)
+    ok &= fwrite(payloads[i], 1, entries[i].compSize, f) == entries[i].compSize;
+  ok &= fclose(f) == 0;
+  return ok;
+}
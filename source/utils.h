@@ -37,6 +37,40 @@ u64 runningTID()
   return tid;
 }
 
+#define UC(c) ((unsigned char)c)
+
+char _isxdigit (unsigned char c)
+{
+    if (( c >= UC('0') && c <= UC('9') ) ||
+        ( c >= UC('a') && c <= UC('f') ) ||
+        ( c >= UC('A') && c <= UC('F') ))
+        return 1;
+    return 0;
+}
+
+unsigned char xtoc(char x) {
+    if (x >= UC('0') && x <= UC('9'))
+        return x - UC('0');
+    else if (x >= UC('a') && x <= UC('f'))
+        return (x - UC('a')) + 0xa;
+    else if (x >= UC('A') && x <= UC('F'))
+        return (x - UC('A')) + 0xA;
+    return -1;
+}
+
+uint64_t hex_to_u64(const char* str) {
+    uint64_t value = 0;
+    if(str[0] == '0' && str[1] == 'x') {
+        str += 2;
+        while(_isxdigit(*str)) {
+            value *= 0x10;
+            value += xtoc(*str);
+            str++;
+        }
+    }
+    return value;
+}
+
 bool fileExists (const std::string& name) {
     return (access(name.c_str(), F_OK) != -1);
 }
@@ -0,0 +1,88 @@
+#pragma once
+#include <switch.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+/*
+ * backup_mode=romfs in config.txt installs without backups and restores regions from an
+ * unmodified copy of data.arc instead. The copy has to be named with vanilla_arc, e.g.
+ *   backup_mode=romfs
+ *   vanilla_arc=sdmc:/UltimateModManager/vanilla.arc
+ * The game's own romfs:/data.arc can not be used: once the SD card has a data.arc,
+ * LayeredFS serves that modded file in its place. Without vanilla_arc, or with a romfs path,
+ * the installer backs up to the SD card as with backup_mode=sd.
+ */
+#define BACKUP_MODE_SD 0     // copy every overwritten region to the backups folder
+#define BACKUP_MODE_ROMFS 1  // no backups, restore regions from vanillaArcPath
+
+int backupMode = BACKUP_MODE_SD;
+std::string vanillaArcPath;  // unmodified data.arc to restore from
+FILE* vanillaArc = nullptr;
+
+// Why vanilla_arc can not be used with backup_mode=romfs, empty if it can
+std::string vanillaArcConfigProblem(const std::string& path) {
+  if(path.empty())
+    return "vanilla_arc is not set";
+  if(path.rfind("romfs:", 0) == 0)
+    return "LayeredFS serves the SD card's data.arc as " + path;
+  return "";
+}
+
+FILE* openVanillaArc() {
+  if(vanillaArc != nullptr)
+    return vanillaArc;
+  vanillaArc = fopen(vanillaArcPath.c_str(), "rb");
+  if(vanillaArc == nullptr)
+    printf(CONSOLE_RED "Failed to open %s\n" CONSOLE_RESET, vanillaArcPath.c_str());
+  return vanillaArc;
+}
+
+void closeVanillaArc() {
+  if(vanillaArc != nullptr) {
+    fclose(vanillaArc);
+    vanillaArc = nullptr;
+  }
+}
+
+bool readVanillaRegion(u64 offset, char* buf, u64 size) {
+  FILE* f = openVanillaArc();
+  if(f == nullptr)
+    return false;
+  fseek(f, offset, SEEK_SET);
+  return fread(buf, sizeof(char), size, f) == size;
+}
+
+// Why vanillaArcPath can not be trusted to hold the unmodified data.arc, empty if it can.
+// arc is the data.arc mods are installed to, written the regions (offset, size) they changed.
+std::string vanillaArcProblem(const std::string& arcPath, FILE* arc, const std::vector<std::pair<u64, u64>>& written) {
+  std::error_code ec;
+  if(std::filesystem::equivalent(vanillaArcPath, arcPath, ec))
+    return "it is the data.arc mods are installed to";
+  if(openVanillaArc() == nullptr)
+    return "it could not be opened";
+  // a copy made after installing mods reads back the mods where they were written
+  const u64 sampleSize = 0x10000;
+  char* vanilla = new char[sampleSize];
+  char* installed = new char[sampleSize];
+  size_t compared = 0, same = 0;
+  for(auto& [offset, size] : written) {
+    if(compared == 8) break;
+    u64 len = std::min(size, sampleSize);
+    if(len == 0 || !readVanillaRegion(offset, vanilla, len))
+      continue;
+    fseek(arc, offset, SEEK_SET);
+    if(fread(installed, sizeof(char), len, arc) != len)
+      continue;
+    compared++;
+    if(memcmp(vanilla, installed, len) == 0) same++;
+  }
+  delete[] vanilla;
+  delete[] installed;
+  if(compared > 0 && same == compared)
+    return "it holds the installed mods";
+  return "";
+}
@@ -0,0 +1,116 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+
+// Streaming XXH64, used to fingerprint mod sources and the frames written to data.arc
+class xxhash64
+{
+private:
+  static const uint64_t P1 = 0x9E3779B185EBCA87ULL;
+  static const uint64_t P2 = 0xC2B2AE3D27D4EB4FULL;
+  static const uint64_t P3 = 0x165667B19E3779F9ULL;
+  static const uint64_t P4 = 0x85EBCA77C2B2AE63ULL;
+  static const uint64_t P5 = 0x27D4EB2F165667C5ULL;
+  uint64_t v[4];
+  uint64_t totalLen;
+  unsigned char mem[32];
+  size_t memSize;
+  uint64_t seed;
+
+  static uint64_t rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+  static uint64_t read64(const unsigned char* p) { uint64_t v; memcpy(&v, p, 8); return v; }
+  static uint32_t read32(const unsigned char* p) { uint32_t v; memcpy(&v, p, 4); return v; }
+  static uint64_t round(uint64_t acc, uint64_t input) {
+    acc += input * P2;
+    acc = rotl(acc, 31);
+    return acc * P1;
+  }
+  static uint64_t mergeRound(uint64_t acc, uint64_t val) {
+    acc ^= round(0, val);
+    return acc * P1 + P4;
+  }
+  void consume(const unsigned char* p) {
+    for(int i = 0; i < 4; i++)
+      v[i] = round(v[i], read64(p + i*8));
+  }
+public:
+  xxhash64(uint64_t seed = 0) { reset(seed); }
+  void reset(uint64_t newSeed = 0)
+  {
+    seed = newSeed;
+    v[0] = seed + P1 + P2;
+    v[1] = seed + P2;
+    v[2] = seed;
+    v[3] = seed - P1;
+    totalLen = 0;
+    memSize = 0;
+  }
+  void update(const void* data, size_t len)
+  {
+    const unsigned char* p = (const unsigned char*) data;
+    totalLen += len;
+    if(memSize + len < 32) {
+      memcpy(mem + memSize, p, len);
+      memSize += len;
+      return;
+    }
+    if(memSize) {
+      size_t fill = 32 - memSize;
+      memcpy(mem + memSize, p, fill);
+      consume(mem);
+      p += fill;
+      len -= fill;
+      memSize = 0;
+    }
+    while(len >= 32) {
+      consume(p);
+      p += 32;
+      len -= 32;
+    }
+    memcpy(mem, p, len);
+    memSize = len;
+  }
+  uint64_t digest() const
+  {
+    uint64_t h;
+    if(totalLen >= 32) {
+      h = rotl(v[0], 1) + rotl(v[1], 7) + rotl(v[2], 12) + rotl(v[3], 18);
+      for(int i = 0; i < 4; i++)
+        h = mergeRound(h, v[i]);
+    }
+    else h = seed + P5;
+    h += totalLen;
+    const unsigned char* p = mem;
+    size_t len = memSize;
+    while(len >= 8) {
+      h ^= round(0, read64(p));
+      h = rotl(h, 27) * P1 + P4;
+      p += 8;
+      len -= 8;
+    }
+    if(len >= 4) {
+      h ^= (uint64_t)read32(p) * P1;
+      h = rotl(h, 23) * P2 + P3;
+      p += 4;
+      len -= 4;
+    }
+    while(len > 0) {
+      h ^= (*p) * P5;
+      h = rotl(h, 11) * P1;
+      p++;
+      len--;
+    }
+    h ^= h >> 33;
+    h *= P2;
+    h ^= h >> 29;
+    h *= P3;
+    h ^= h >> 32;
+    return h;
+  }
+  static uint64_t hash(const void* data, size_t len, uint64_t seed = 0)
+  {
+    xxhash64 state(seed);
+    state.update(data, len);
+    return state.digest();
+  }
+};
@@ -0,0 +1,73 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <chrono>
+#define ZSTD_STATIC_LINKING_ONLY
+#include <zstd.h>
+
+/*
+ * Building zstd frames that exactly fill a data.arc region. Shared by the installer and
+ * the host tools, so nothing here may depend on libnx.
+ */
+
+// Called after every level compressFrame() tries when set, outSize may be a zstd error code
+void (*frameAttemptHook)(int level, uint64_t inSize, size_t outSize, uint64_t compSize, double seconds) = nullptr;
+
+// Compresses at increasing levels until the frame fits in compSize. outBuff must hold
+// compSize+1 bytes. Returns false if no level fits.
+bool compressFrame(ZSTD_CCtx* ctx, const char* inBuff, uint64_t inSize, char* outBuff, uint64_t compSize, uint64_t &dataSize)
+{
+  int compLvl = 3;
+  ZSTD_parameters params;
+  params.fParams = {0,0,1};  // Minimize header size
+  do
+  {
+    auto start = std::chrono::steady_clock::now();
+    params.cParams = ZSTD_getCParams(compLvl, inSize, 0);
+    dataSize = ZSTD_compress_advanced(ctx, outBuff, compSize+1, inBuff, inSize, nullptr, 0, params);
+    if(frameAttemptHook != nullptr)
+      frameAttemptHook(compLvl, inSize, dataSize, compSize,
+                       std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    compLvl++;
+    if(compLvl==8) compLvl = 17;  // skip arbitrary amount of levels for speed.
+  }
+  while ((dataSize > compSize || ZSTD_isError(dataSize)) && compLvl <= ZSTD_maxCLevel());
+  return !(dataSize > compSize || ZSTD_isError(dataSize));
+}
+
+// The level after compLvl that compressFrame() would try, or 0 once none are left
+int nextFrameLevel(int compLvl) {
+  compLvl++;
+  if(compLvl==8) compLvl = 17;
+  return compLvl <= ZSTD_maxCLevel() ? compLvl : 0;
+}
+
+// Fills bytes [start, start+len) of a paddingSize byte padding run. The padding is zero
+// bytes the decoder reads as empty blocks, with a marker or two to make the length line up.
+void fillPadding(char* buf, uint64_t start, uint64_t len, uint64_t paddingSize) {
+  memset(buf, 0, len);
+  uint64_t markers[2] = {paddingSize - 4, paddingSize - 8};
+  for(uint64_t i = 0; i < paddingSize % 3 && paddingSize >= 4 * (i + 1); i++) {
+    if(markers[i] >= start && markers[i] < start + len)
+      buf[markers[i] - start] = 2;
+  }
+}
+
+// Lays out a frame from compressFrame() in compSize bytes: the frame header, then padding,
+// then the compressed blocks.
+void padFrame(const char* compBuf, uint64_t realCompSize, uint64_t compSize, char* out) {
+  uint64_t headerSize = ZSTD_frameHeaderSize(compBuf, compSize);
+  uint64_t paddingSize = (compSize - realCompSize);
+  memcpy(out, compBuf, headerSize);
+  fillPadding(out + headerSize, 0, paddingSize, paddingSize);
+  memcpy(out + headerSize + paddingSize, compBuf + headerSize, realCompSize - headerSize);
+}
+
+// Checks that a padded frame decompresses to exactly data
+bool frameMatches(ZSTD_DCtx* ctx, const char* frame, uint64_t frameSize, const char* data, uint64_t size) {
+  char* out = new char[size + 1];
+  size_t outSize = ZSTD_decompressDCtx(ctx, out, size + 1, frame, frameSize);
+  bool ret = !ZSTD_isError(outSize) && outSize == size && memcmp(out, data, size) == 0;
+  delete[] out;
+  return ret;
+}